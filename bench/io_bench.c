@@ -0,0 +1,151 @@
+// Demuxes a file through each input backend and reports throughput and CPU time.
+// Usage: io_bench <file> [gigabytes] [warm]
+// Reads at most the given amount per backend (all of it by default). Unless
+// "warm" is given, the file's pages are dropped from the page cache before each
+// run, so every backend starts from the disk.
+
+#include "../src/mmap_io.h"
+#include "../src/readahead_io.h"
+#include "../src/uring_io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <libavformat/avformat.h>
+#include <libavutil/time.h>
+
+typedef struct
+{
+    int64_t bytes;
+    int64_t packets;
+    double wall;
+    double user;
+    double sys;
+} BenchResult;
+
+static double cpu_seconds(struct timeval tv)
+{
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void evict_page_cache(const char *filename)
+{
+#if defined(__linux__)
+    int fd = open(filename, O_RDONLY);
+    if (fd >= 0)
+    {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#else
+    (void)filename;
+#endif
+}
+
+// pb NULL opens the file with FFmpeg's own protocol.
+static int run(const char *filename, AVIOContext *pb, int64_t limit, BenchResult *result)
+{
+    AVFormatContext *fmt = NULL;
+    if (pb)
+    {
+        fmt = avformat_alloc_context();
+        fmt->pb = pb;
+        fmt->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    int64_t start = av_gettime_relative();
+    if (avformat_open_input(&fmt, filename, NULL, NULL) < 0)
+        return -1;
+
+    AVPacket *pkt = av_packet_alloc();
+    memset(result, 0, sizeof(*result));
+    while (result->bytes < limit && av_read_frame(fmt, pkt) >= 0)
+    {
+        result->bytes += pkt->size;
+        result->packets++;
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+    avformat_close_input(&fmt);
+
+    result->wall = (av_gettime_relative() - start) / 1000000.0;
+    getrusage(RUSAGE_SELF, &after);
+    result->user = cpu_seconds(after.ru_utime) - cpu_seconds(before.ru_utime);
+    result->sys = cpu_seconds(after.ru_stime) - cpu_seconds(before.ru_stime);
+    return 0;
+}
+
+static void report(const char *name, const BenchResult *r)
+{
+    printf("%-10s %10.1f MB %10lld packets %8.2f s %8.1f MB/s   user %6.2f s  sys %6.2f s\n", name,
+           r->bytes / 1048576.0, (long long)r->packets, r->wall, r->bytes / 1048576.0 / r->wall, r->user, r->sys);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <file> [gigabytes] [warm]\n", argv[0]);
+        return 1;
+    }
+    const char *filename = argv[1];
+    int64_t limit = argc > 2 && atof(argv[2]) > 0 ? (int64_t)(atof(argv[2]) * 1073741824.0) : INT64_MAX;
+    int warm = argc > 3 && strcmp(argv[3], "warm") == 0;
+    BenchResult r;
+
+    if (!warm)
+        evict_page_cache(filename);
+    if (run(filename, NULL, limit, &r) < 0)
+    {
+        fprintf(stderr, "ERROR: Could not open %s\n", filename);
+        return 1;
+    }
+    report("avio", &r);
+
+    MmapIO mmap_input;
+    if (!warm)
+        evict_page_cache(filename);
+    if (mmap_io_open(&mmap_input, filename) == 0)
+    {
+        if (run(filename, mmap_input.avio, limit, &r) == 0)
+            report("mmap", &r);
+        mmap_io_close(&mmap_input);
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Could not map %s\n", filename);
+    }
+
+    ReadaheadIO readahead;
+    if (!warm)
+        evict_page_cache(filename);
+    if (readahead_io_open(&readahead, filename) == 0)
+    {
+        if (run(filename, readahead.avio, limit, &r) == 0)
+            report("readahead", &r);
+        readahead_io_close(&readahead);
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Could not open %s for read-ahead\n", filename);
+    }
+
+    UringIO uring_input;
+    if (!warm)
+        evict_page_cache(filename);
+    if (uring_io_open(&uring_input, filename) == 0)
+    {
+        if (run(filename, uring_input.avio, limit, &r) == 0)
+            report("io_uring", &r);
+        uring_io_close(&uring_input);
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Could not open %s with io_uring\n", filename);
+    }
+    return 0;
+}
@@ -0,0 +1,124 @@
+// Times yuv2rgba() against sws_scale() on frames decoded from a real file.
+// Usage: yuv2rgb_bench <video> [frames]
+
+#include "../src/yuv2rgb.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+#include <libavutil/time.h>
+
+#define BENCH_DEFAULT_FRAMES 300
+#define BENCH_REPEAT 5
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <video> [frames]\n", argv[0]);
+        return 1;
+    }
+    int max_frames = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_FRAMES;
+
+    AVFormatContext *fmt = NULL;
+    if (avformat_open_input(&fmt, argv[1], NULL, NULL) < 0 || avformat_find_stream_info(fmt, NULL) < 0)
+    {
+        fprintf(stderr, "ERROR: Could not open %s\n", argv[1]);
+        return 1;
+    }
+    const AVCodec *codec = NULL;
+    int stream = av_find_best_stream(fmt, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (stream < 0)
+    {
+        fprintf(stderr, "ERROR: No video stream\n");
+        return 1;
+    }
+    AVCodecContext *ctx = avcodec_alloc_context3(codec);
+    avcodec_parameters_to_context(ctx, fmt->streams[stream]->codecpar);
+    if (avcodec_open2(ctx, codec, NULL) < 0)
+    {
+        fprintf(stderr, "ERROR: Could not open codec\n");
+        return 1;
+    }
+    if (!yuv2rgba_supported(ctx->pix_fmt))
+    {
+        fprintf(stderr, "ERROR: %s is not handled by the %s kernel\n", av_get_pix_fmt_name(ctx->pix_fmt),
+                yuv2rgba_kernel_name());
+        return 1;
+    }
+
+    // Decode up front so that only the conversions are timed.
+    AVFrame **frames = calloc(max_frames, sizeof(*frames));
+    int nb_frames = 0;
+    AVPacket *pkt = av_packet_alloc();
+    while (nb_frames < max_frames && av_read_frame(fmt, pkt) >= 0)
+    {
+        if (pkt->stream_index == stream && avcodec_send_packet(ctx, pkt) >= 0)
+        {
+            AVFrame *frame = av_frame_alloc();
+            while (nb_frames < max_frames && avcodec_receive_frame(ctx, frame) >= 0)
+            {
+                frames[nb_frames++] = frame;
+                frame = av_frame_alloc();
+            }
+            av_frame_free(&frame);
+        }
+        av_packet_unref(pkt);
+    }
+    if (nb_frames == 0)
+    {
+        fprintf(stderr, "ERROR: No frames decoded\n");
+        return 1;
+    }
+
+    int width = ctx->width, height = ctx->height;
+    int linesize = width * 4;
+    uint8_t *simd_out = malloc((size_t)linesize * height);
+    uint8_t *sws_out = malloc((size_t)linesize * height);
+    struct SwsContext *sws = sws_getContext(width, height, ctx->pix_fmt, width, height, AV_PIX_FMT_RGBA, SWS_BICUBIC,
+                                            NULL, NULL, NULL);
+
+    int64_t simd_time = 0, sws_time = 0;
+    int max_diff = 0;
+    for (int rep = 0; rep < BENCH_REPEAT; rep++)
+    {
+        for (int i = 0; i < nb_frames; i++)
+        {
+            int64_t start = av_gettime_relative();
+            yuv2rgba(frames[i], simd_out, linesize);
+            simd_time += av_gettime_relative() - start;
+
+            start = av_gettime_relative();
+            sws_scale(sws, (const uint8_t *const *)frames[i]->data, frames[i]->linesize, 0, height, &sws_out, &linesize);
+            sws_time += av_gettime_relative() - start;
+
+            if (rep == 0)
+            {
+                for (int j = 0; j < linesize * height; j++)
+                {
+                    int diff = abs(simd_out[j] - sws_out[j]);
+                    if (diff > max_diff)
+                        max_diff = diff;
+                }
+            }
+        }
+    }
+
+    double runs = (double)nb_frames * BENCH_REPEAT;
+    printf("%dx%d %s, %d frames x %d\n", width, height, av_get_pix_fmt_name(ctx->pix_fmt), nb_frames, BENCH_REPEAT);
+    printf("  %-10s %8.3f ms/frame\n", yuv2rgba_kernel_name(), simd_time / runs / 1000.0);
+    printf("  %-10s %8.3f ms/frame\n", "sws_scale", sws_time / runs / 1000.0);
+    printf("  speedup    %8.2fx, max channel difference %d\n", (double)sws_time / simd_time, max_diff);
+
+    for (int i = 0; i < nb_frames; i++)
+        av_frame_free(&frames[i]);
+    free(frames);
+    free(simd_out);
+    free(sws_out);
+    sws_freeContext(sws);
+    av_packet_free(&pkt);
+    avcodec_free_context(&ctx);
+    avformat_close_input(&fmt);
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include "clock.h"
+
+#include <math.h>
+#include <libavutil/time.h>
+
+void clock_init(Clock *c)
+{
+    c->pts = NAN;
+    c->max_pts = NAN;
+    c->last_updated = av_gettime_relative();
+    c->paused = false;
+    c->speed = 1.0;
+    pthread_mutex_init(&c->mutex, NULL);
+}
+
+void clock_destroy(Clock *c)
+{
+    pthread_mutex_destroy(&c->mutex);
+}
+
+void clock_set(Clock *c, double pts, double max_pts)
+{
+    pthread_mutex_lock(&c->mutex);
+    c->pts = pts;
+    c->max_pts = max_pts;
+    c->last_updated = av_gettime_relative();
+    pthread_mutex_unlock(&c->mutex);
+}
+
+void clock_set_paused(Clock *c, bool paused)
+{
+    pthread_mutex_lock(&c->mutex);
+    if (c->paused != paused)
+    {
+        int64_t now = av_gettime_relative();
+        // Fold the time elapsed so far into pts so pausing freezes the clock where it is.
+        if (!c->paused && !isnan(c->pts))
+            c->pts = fmin(c->pts + (now - c->last_updated) / 1000000.0 * c->speed, c->max_pts);
+        c->last_updated = now;
+        c->paused = paused;
+    }
+    pthread_mutex_unlock(&c->mutex);
+}
+
+void clock_set_speed(Clock *c, double speed)
+{
+    pthread_mutex_lock(&c->mutex);
+    int64_t now = av_gettime_relative();
+    // Time elapsed at the old speed is folded in first.
+    if (!c->paused && !isnan(c->pts))
+        c->pts = fmin(c->pts + (now - c->last_updated) / 1000000.0 * c->speed, c->max_pts);
+    c->last_updated = now;
+    c->speed = speed;
+    pthread_mutex_unlock(&c->mutex);
+}
+
+double clock_get(Clock *c)
+{
+    pthread_mutex_lock(&c->mutex);
+    double pts = c->pts;
+    if (!c->paused && !isnan(pts))
+        pts = fmin(pts + (av_gettime_relative() - c->last_updated) / 1000000.0 * c->speed, c->max_pts);
+    pthread_mutex_unlock(&c->mutex);
+    return pts;
+}
@@ -0,0 +1,30 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// A playback clock that is updated from one thread and read from another.
+// Between updates it extrapolates from the monotonic system clock at the playback
+// speed, never past max_pts.
+struct Clock
+{
+    double pts;                 // seconds, NAN when unknown
+    double max_pts;             // furthest point backed by real samples
+    int64_t last_updated;       // av_gettime_relative() at the last update, microseconds
+    double speed;               // media seconds per wall-clock second
+    bool paused;
+    pthread_mutex_t mutex;
+};
+
+typedef struct Clock Clock;
+
+void clock_init(Clock *c);
+void clock_destroy(Clock *c);
+void clock_set(Clock *c, double pts, double max_pts);
+void clock_set_paused(Clock *c, bool paused);
+void clock_set_speed(Clock *c, double speed);
+double clock_get(Clock *c);
+
+#endif // CLOCK_H
@@ -1,7 +1,10 @@
 #include "decoder.h"
+#include "yuv2rgb.h"
+#include "time_stretch.h"
 #include "raylib.h"
 #include <stdbool.h>
 #include <stdlib.h>
+#include <math.h>
 #include <libavutil/opt.h>
 #include <libavcodec/avcodec.h>
 #include <libswscale/swscale.h>
@@ -9,16 +12,154 @@
 #include <libavutil/audio_fifo.h>
 #include <libswresample/swresample.h>
 #include <libavutil/dict.h>
+#include <libavutil/time.h>
+#include <time.h>
+#include <string.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#endif
 
-#define FIFO_MIN_FRAMES 1024 * 4
+// Demuxer read-ahead limits: stop reading once the queues hold this many bytes,
+// or once both streams have at least this much media buffered.
+#define MAX_QUEUE_SIZE (64 * 1024 * 1024)
+#define MAX_QUEUE_DURATION 2.0
+#define MIN_QUEUE_PACKETS 25
+#define DEMUX_WAIT_MS 10
+
+// A frame that is this far behind its slot resets the presentation timer instead of catching up.
+#define FRAME_RESYNC_THRESHOLD 0.1
+// Frames are shown once they are at most this far ahead of the audio clock.
+#define SYNC_EARLY_TOLERANCE 0.008
+// Beyond this difference the timestamps are not comparable and video runs on the wall clock.
+#define NOSYNC_THRESHOLD 10.0
+// After this many late frames in a row the decoder stops producing non-reference frames,
+// and it resumes once this many frames in a row arrive in time.
+#define LATE_FRAMES_SKIP_NONREF 8
+#define ON_TIME_FRAMES_RESUME 30
+// Dropping late frames must not freeze the picture when decoding cannot keep up
+// at all: one is let through after this many in a row, or once this long has
+// passed since the last frame was kept.
+#define LATE_FRAMES_MAX_DROPPED 12
+#define LATE_FRAMES_MAX_GAP 0.1
+// On an exact seek, a frame ending this close after the target still counts as before it.
+#define SEEK_EXACT_TOLERANCE 0.001
+// Trick play keeps this many keyframes queued ahead of the decoder, and gives
+// up on a hop that reads this many packets without finding one.
+#define TRICK_QUEUE_PACKETS 2
+#define TRICK_MAX_PACKETS 1000
+// libswscale threads for the CPU RGBA path; each scales one horizontal slice.
+// 0 lets libswscale use one per core. The AVP_SCALE_THREADS environment
+// variable overrides it.
+#define SCALE_THREADS 0
 
 DecoderState ds = {0};
-int64_t frame_time = 0;
-float playback_speed = 1.25;
+double frame_time = 0;
+
+static void rgba_buffer_free(void *opaque, uint8_t *data)
+{
+    (void)opaque;
+    (void)data;
+}
+
+// Built through AVOptions because sws_getContext() has no way to set "threads".
+static struct SwsContext *create_scaler(int width, int height, int threads)
+{
+    struct SwsContext *sws = sws_alloc_context();
+    if (!sws)
+        return NULL;
+    av_opt_set_int(sws, "srcw", ds.video_codec_ctx->width, 0);
+    av_opt_set_int(sws, "srch", ds.video_codec_ctx->height, 0);
+    av_opt_set_int(sws, "src_format", ds.video_codec_ctx->pix_fmt, 0);
+    av_opt_set_int(sws, "dstw", width, 0);
+    av_opt_set_int(sws, "dsth", height, 0);
+    av_opt_set_int(sws, "dst_format", AV_PIX_FMT_RGBA, 0);
+    av_opt_set_int(sws, "sws_flags", SWS_BICUBIC, 0);
+    av_opt_set_int(sws, "threads", threads, 0);
+    if (sws_init_context(sws, NULL, NULL) < 0)
+    {
+        sws_freeContext(sws);
+        return NULL;
+    }
+    return sws;
+}
+
+static bool on_network_filesystem(const char *filename)
+{
+#if defined(__linux__)
+    struct statfs st;
+    if (statfs(filename, &st) < 0)
+        return false;
+    switch ((unsigned long)st.f_type)
+    {
+    case NFS_SUPER_MAGIC:
+    case SMB_SUPER_MAGIC:
+    case CIFS_SUPER_MAGIC:
+    case SMB2_SUPER_MAGIC:
+    case FUSE_SUPER_MAGIC:
+        return true;
+    }
+#else
+    (void)filename;
+#endif
+    return false;
+}
+
+static enum InputBackend choose_input_backend(const char *filename)
+{
+    const char *choice = getenv("AVP_INPUT");
+    if (choice && strcmp(choice, "avio") == 0)
+        return INPUT_AVIO;
+    if (choice && strcmp(choice, "readahead") == 0)
+        return INPUT_READAHEAD;
+    if (choice && strcmp(choice, "mmap") == 0)
+        return INPUT_MMAP;
+    if (choice && strcmp(choice, "io_uring") == 0)
+        return INPUT_URING;
+    if (on_network_filesystem(filename))
+        return INPUT_READAHEAD;
+    struct stat st;
+    if (stat(filename, &st) == 0 && st.st_size >= URING_IO_DIRECT_MIN_BYTES)
+        return INPUT_URING;
+    return INPUT_MMAP;
+}
+
+// Backends only take regular files; for anything else, or when one cannot be
+// set up, the file goes to the protocol FFmpeg picks. io_uring may also be
+// missing from the kernel or blocked by a seccomp filter, and falls back to mmap.
+static int open_input(const char *filename)
+{
+    AVIOContext *pb = NULL;
+    ds.input_backend = choose_input_backend(filename);
+    if (ds.input_backend == INPUT_URING)
+    {
+        if (uring_io_open(&ds.uring_input, filename) == 0)
+            pb = ds.uring_input.avio;
+        else
+            ds.input_backend = INPUT_MMAP;
+    }
+    if (ds.input_backend == INPUT_READAHEAD && readahead_io_open(&ds.readahead, filename) == 0)
+        pb = ds.readahead.avio;
+    else if (ds.input_backend == INPUT_MMAP && mmap_io_open(&ds.mmap_input, filename) == 0)
+        pb = ds.mmap_input.avio;
+    else if (!pb)
+        ds.input_backend = INPUT_AVIO;
+
+    if (pb)
+    {
+        ds.format_ctx = avformat_alloc_context();
+        if (!ds.format_ctx)
+            return -1;
+        ds.format_ctx->pb = pb;
+        ds.format_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+    return avformat_open_input(&ds.format_ctx, filename, NULL, NULL);
+}
 
 int decoder_init(char *filename)
 {
-    if (avformat_open_input(&ds.format_ctx, filename, NULL, NULL) < 0)
+    if (open_input(filename) < 0)
     {
         fprintf(stderr, "ERROR: Could not open file: %s\n", filename);
         return -1;
@@ -29,6 +170,8 @@ int decoder_init(char *filename)
         fprintf(stderr, "ERROR: Could not find stream info\n");
         return -1;
     }
+    if (ds.input_backend == INPUT_READAHEAD)
+        readahead_io_set_bitrate(&ds.readahead, ds.format_ctx->bit_rate);
 
     ds.video_stream_idx = av_find_best_stream(ds.format_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
     ds.audio_stream_idx = av_find_best_stream(ds.format_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
@@ -45,6 +188,12 @@ int decoder_init(char *filename)
 
     ds.video_stream = ds.format_ctx->streams[ds.video_stream_idx];
     ds.audio_stream = ds.format_ctx->streams[ds.audio_stream_idx];
+
+    // Raw streams and MPEG-TS have no index to seek with; build one in the background
+    // so seeks can jump straight to a keyframe's byte offset.
+    if (!(ds.format_ctx->iformat->flags & AVFMT_NO_BYTE_SEEK) && avformat_index_get_entries_count(ds.video_stream) == 0)
+        ds.has_keyframe_index = keyframe_index_open(&ds.keyframes, filename, ds.video_stream_idx) == 0;
+    ds.has_reverse = reverse_decoder_open(&ds.reverse, filename, ds.video_stream_idx) == 0;
     const AVCodec *video_codec = avcodec_find_decoder(ds.video_stream->codecpar->codec_id);
     const AVCodec *audio_codec = avcodec_find_decoder(ds.audio_stream->codecpar->codec_id);
 
@@ -83,6 +232,14 @@ int decoder_init(char *filename)
         return -1;
     }
 
+    ds.frame_pool = frame_pool_alloc();
+    if (!ds.frame_pool)
+    {
+        fprintf(stderr, "ERROR: Could not allocate frame pool\n");
+        return -1;
+    }
+    frame_pool_install(ds.frame_pool, ds.video_codec_ctx);
+
     if (avcodec_open2(ds.video_codec_ctx, video_codec, NULL) < 0)
     {
         fprintf(stderr, "ERROR: Could not open video codec\n");
@@ -97,13 +254,63 @@ int decoder_init(char *filename)
     ds.frame = av_frame_alloc();
     ds.packet = av_packet_alloc();
 
-    ds.sws_ctx = sws_getContext(ds.video_codec_ctx->width, ds.video_codec_ctx->height, ds.video_codec_ctx->pix_fmt, ds.video_codec_ctx->width, ds.video_codec_ctx->height, AV_PIX_FMT_RGBA, SWS_BICUBIC, NULL, NULL, NULL);
+    switch (ds.video_codec_ctx->pix_fmt)
+    {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+        ds.frame_format = FRAME_FORMAT_YUV420P;
+        break;
+    case AV_PIX_FMT_NV12:
+        ds.frame_format = FRAME_FORMAT_NV12;
+        break;
+    case AV_PIX_FMT_P010LE:
+    case AV_PIX_FMT_P016LE:
+        ds.frame_format = FRAME_FORMAT_P010;
+        break;
+    case AV_PIX_FMT_YUV420P10LE:
+    case AV_PIX_FMT_YUV420P12LE:
+    case AV_PIX_FMT_YUV420P16LE:
+        ds.frame_format = FRAME_FORMAT_YUV420P16;
+        break;
+    case AV_PIX_FMT_RGBA:
+    case AV_PIX_FMT_BGRA:
+    case AV_PIX_FMT_ARGB:
+    case AV_PIX_FMT_ABGR:
+    case AV_PIX_FMT_RGB0:
+    case AV_PIX_FMT_BGR0:
+    case AV_PIX_FMT_0RGB:
+    case AV_PIX_FMT_0BGR:
+    case AV_PIX_FMT_RGB24:
+    case AV_PIX_FMT_BGR24:
+        ds.frame_format = FRAME_FORMAT_PACKED_RGB;
+        break;
+    default:
+        ds.frame_format = FRAME_FORMAT_RGBA;
+        break;
+    }
+
+    ds.scale_threads = ds.scaled_threads = SCALE_THREADS;
+    ds.sws_ctx = create_scaler(ds.video_codec_ctx->width, ds.video_codec_ctx->height, ds.scale_threads);
 
     if (!ds.sws_ctx)
     {
         fprintf(stderr, "ERROR: Could not create SwsContext\n");
         return -1;
     }
+    // sws_scale_frame() allocates a destination that has no buf[0]. This one
+    // placeholder, never written through, lets it write to data[0] instead,
+    // which each conversion points at the slot memory the renderer owns.
+    ds.rgba_frame = av_frame_alloc();
+    if (ds.rgba_frame)
+        ds.rgba_frame->buf[0] = av_buffer_create(NULL, 0, rgba_buffer_free, NULL, 0);
+    if (!ds.rgba_frame || !ds.rgba_frame->buf[0])
+    {
+        fprintf(stderr, "ERROR: Could not allocate frame\n");
+        return -1;
+    }
+    pthread_mutex_init(&ds.output_mutex, NULL);
+    ds.output_width = ds.scaled_width = ds.video_codec_ctx->width;
+    ds.output_height = ds.scaled_height = ds.video_codec_ctx->height;
 
     ds.swr_ctx = swr_alloc();
     if (!ds.swr_ctx)
@@ -128,124 +335,1154 @@ int decoder_init(char *filename)
         fprintf(stderr, "ERROR: Could not initialize SwrContext\n");
         return -1;
     }
-    ds.rgba_frame_buffer = malloc(ds.video_codec_ctx->width * ds.video_codec_ctx->height * 4);
-    memset(ds.rgba_frame_buffer, 0, ds.video_codec_ctx->width * ds.video_codec_ctx->height * 4);
-    ds.fifo = av_audio_fifo_alloc(AV_SAMPLE_FMT_FLT, 2, FIFO_MIN_FRAMES * 2);
+    ds.fifo = av_audio_fifo_alloc(AV_SAMPLE_FMT_FLT, 2, FIFO_HIGH_WATERMARK * 2);
+    if (!ds.fifo)
+    {
+        fprintf(stderr, "ERROR: Could not allocate audio FIFO\n");
+        return -1;
+    }
+    pthread_mutex_init(&ds.fifo_mutex, NULL);
+    pthread_cond_init(&ds.fifo_cond, NULL);
+    decoder_set_audio_watermarks(FIFO_LOW_WATERMARK, FIFO_HIGH_WATERMARK);
+    ds.fifo_end_pts = ds.audio_decoded_end = NAN;
+    ds.playback_speed = 1.0;
+    if (time_stretch_init(&ds.stretch, ds.audio_codec_ctx->sample_rate) < 0)
+    {
+        fprintf(stderr, "ERROR: Could not allocate time stretcher\n");
+        return -1;
+    }
+    ds.seek_target = ds.video_seek_target = ds.audio_seek_target = NAN;
+    frame_history_init(&ds.history, (size_t)HISTORY_BUDGET_MB * 1024 * 1024);
+    clock_init(&ds.audclk);
+
+    if (packet_queue_init(&ds.audioq) < 0 || packet_queue_init(&ds.videoq) < 0)
+        return -1;
+    if (frame_queue_init(&ds.pictq, &ds.videoq) < 0)
+        return -1;
+    pthread_mutex_init(&ds.demux_mutex, NULL);
+    pthread_cond_init(&ds.continue_read_cond, NULL);
     return 0;
 }
 
-int decoder_decode_frame(Texture texture, int64_t *frame_time)
+static bool queue_has_enough(PacketQueue *q, AVStream *stream)
 {
-    int read_bytes = av_read_frame(ds.format_ctx, ds.packet);
-    if (read_bytes < 0)
-        return -1;
+    return q->nb_packets > MIN_QUEUE_PACKETS &&
+           (!q->duration || av_q2d(stream->time_base) * q->duration > MAX_QUEUE_DURATION);
+}
+
+static void demux_wait(void)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += DEMUX_WAIT_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&ds.demux_mutex);
+    if (!ds.abort_request && !ds.seek_req)
+        pthread_cond_timedwait(&ds.continue_read_cond, &ds.demux_mutex, &deadline);
+    pthread_mutex_unlock(&ds.demux_mutex);
+}
+
+static void wake_demuxer(void)
+{
+    pthread_mutex_lock(&ds.demux_mutex);
+    pthread_cond_signal(&ds.continue_read_cond);
+    pthread_mutex_unlock(&ds.demux_mutex);
+}
+
+// From here on only samples decoded from packets of this serial are accepted.
+static void audio_fifo_reset(int serial)
+{
+    pthread_mutex_lock(&ds.fifo_mutex);
+    av_audio_fifo_reset(ds.fifo);
+    ds.fifo_serial = serial;
+    ds.fifo_end_pts = NAN;
+    ds.speed_run_count = 0;
+    ds.fifo_media = 0;
+    pthread_cond_signal(&ds.fifo_cond);
+    pthread_mutex_unlock(&ds.fifo_mutex);
+    clock_set(&ds.audclk, NAN, NAN);
+}
+
+// Goes to the keyframe at or before pos by byte offset when the index has it,
+// otherwise leaves it to the demuxer. Exact seeks must not land past pos.
+static int demux_seek(int64_t pos, int flags)
+{
+    int64_t key_pts, byte_pos;
+    if (ds.has_keyframe_index && keyframe_index_lookup(&ds.keyframes, pos, &key_pts, &byte_pos) &&
+        av_seek_frame(ds.format_ctx, ds.video_stream_idx, byte_pos, AVSEEK_FLAG_BYTE) >= 0)
+        return 0;
+    if (flags & DECODER_SEEK_EXACT)
+        return avformat_seek_file(ds.format_ctx, ds.video_stream_idx, INT64_MIN, pos, pos,
+                                  (flags & ~DECODER_SEEK_EXACT) | AVSEEK_FLAG_BACKWARD);
+    return avformat_seek_file(ds.format_ctx, ds.video_stream_idx, INT64_MIN, pos, INT64_MAX, flags);
+}
+
+// Read by each decoder when it reaches the flush marker of the seek that set it.
+static double take_seek_target(void)
+{
+    pthread_mutex_lock(&ds.demux_mutex);
+    double target = ds.seek_target;
+    pthread_mutex_unlock(&ds.demux_mutex);
+    return target;
+}
+
+static bool trick_play_active(void)
+{
+    pthread_mutex_lock(&ds.demux_mutex);
+    bool active = ds.trick_speed != 0;
+    pthread_mutex_unlock(&ds.demux_mutex);
+    return active;
+}
+
+// Trick play: queues the first video keyframe at or after pos, or at or before
+// it when rewinding, and moves pos one displayed frame's worth of media time
+// past that keyframe. Everything between keyframes is never read.
+static int demux_trick_frame(int64_t *pos, int speed, AVPacket *pkt)
+{
+    int64_t ts = *pos;
+    int ret = speed > 0 ? avformat_seek_file(ds.format_ctx, ds.video_stream_idx, ts, ts, INT64_MAX, 0)
+                        : avformat_seek_file(ds.format_ctx, ds.video_stream_idx, INT64_MIN, ts, ts, AVSEEK_FLAG_BACKWARD);
+    if (ret < 0)
+        return AVERROR_EOF;
+
+    for (int packets = 0; packets < TRICK_MAX_PACKETS; packets++)
+    {
+        if ((ret = av_read_frame(ds.format_ctx, pkt)) < 0)
+            return ret;
+        if (pkt->stream_index == ds.video_stream_idx && (pkt->flags & AV_PKT_FLAG_KEY))
+        {
+            int64_t key = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+            int64_t step = (int64_t)((double)speed / TRICK_FRAMES_PER_SECOND / av_q2d(ds.video_stream->time_base));
+            *pos = (key != AV_NOPTS_VALUE ? key : ts) + step;
+            return packet_queue_put(&ds.videoq, pkt);
+        }
+        av_packet_unref(pkt);
+    }
+    return AVERROR_EOF;
+}
 
-    if (ds.packet->stream_index == ds.audio_stream_idx)
+static void *demux_thread(void *arg)
+{
+    (void)arg;
+    AVPacket *pkt = av_packet_alloc();
+    if (!pkt)
+    {
+        fprintf(stderr, "ERROR: Could not allocate demuxer packet\n");
+        return NULL;
+    }
+    int64_t trick_pos = 0;
+
+    for (;;)
     {
-        if (avcodec_send_packet(ds.audio_codec_ctx, ds.packet) == 0)
+        pthread_mutex_lock(&ds.demux_mutex);
+        bool abort_request = ds.abort_request;
+        bool seek_req = ds.seek_req;
+        int64_t seek_pos = ds.seek_pos;
+        int seek_flags = ds.seek_flags;
+        int trick_speed = ds.trick_speed;
+        ds.seek_req = false;
+        pthread_mutex_unlock(&ds.demux_mutex);
+
+        if (abort_request)
+            break;
+
+        if (seek_req)
+        {
+            if (demux_seek(seek_pos, seek_flags) < 0)
+            {
+                fprintf(stderr, "ERROR: Seek failed\n");
+            }
+            else
+            {
+                pthread_mutex_lock(&ds.demux_mutex);
+                ds.seek_target = seek_flags & DECODER_SEEK_EXACT ? seek_pos * av_q2d(ds.video_stream->time_base) : NAN;
+                pthread_mutex_unlock(&ds.demux_mutex);
+                int audio_serial = packet_queue_put_flush(&ds.audioq);
+                packet_queue_put_flush(&ds.videoq);
+                // Drop what the device has not played yet and wake the audio thread for the marker.
+                audio_fifo_reset(audio_serial);
+                ds.eof = false;
+                trick_pos = seek_pos;
+            }
+        }
+
+        // Audio is not read at all, so the device plays silence.
+        if (trick_speed)
         {
-            while (avcodec_receive_frame(ds.audio_codec_ctx, ds.frame) == 0)
+            if (ds.eof || ds.videoq.nb_packets >= TRICK_QUEUE_PACKETS)
             {
-                AVFrame *resampled_frame = av_frame_alloc();
-                resampled_frame->sample_rate = ds.audio_codec_ctx->sample_rate;
-                AVChannelLayout out_ch_layout;
-                av_channel_layout_default(&out_ch_layout, 2);
-                av_channel_layout_copy(&resampled_frame->ch_layout, &out_ch_layout);
-                resampled_frame->format = AV_SAMPLE_FMT_FLT;
-                resampled_frame->nb_samples = ds.frame->nb_samples;
-
-                swr_convert_frame(ds.swr_ctx, resampled_frame, ds.frame);
-                av_audio_fifo_write(ds.fifo, (void **)resampled_frame->data, resampled_frame->nb_samples);
-                av_frame_free(&resampled_frame);
+                demux_wait();
+                continue;
             }
+            int ret = demux_trick_frame(&trick_pos, trick_speed, pkt);
+            if (ret == AVERROR_EOF || avio_feof(ds.format_ctx->pb))
+                ds.eof = true;
+            continue;
+        }
+
+        if (ds.audioq.size + ds.videoq.size > MAX_QUEUE_SIZE ||
+            (queue_has_enough(&ds.audioq, ds.audio_stream) && queue_has_enough(&ds.videoq, ds.video_stream)))
+        {
+            demux_wait();
+            continue;
         }
+
+        int ret = av_read_frame(ds.format_ctx, pkt);
+        if (ret < 0)
+        {
+            if (ret == AVERROR_EOF || avio_feof(ds.format_ctx->pb))
+                ds.eof = true;
+            demux_wait();
+            continue;
+        }
+
+        if (pkt->stream_index == ds.audio_stream_idx)
+            packet_queue_put(&ds.audioq, pkt);
+        else if (pkt->stream_index == ds.video_stream_idx)
+            packet_queue_put(&ds.videoq, pkt);
+        else
+            av_packet_unref(pkt);
     }
 
-    if (ds.packet->stream_index == ds.video_stream_idx)
+    av_packet_free(&pkt);
+    return NULL;
+}
+
+static double frame_duration(AVFrame *frame)
+{
+    if (frame->duration > 0)
+        return frame->duration * av_q2d(ds.video_stream->time_base);
+    AVRational frame_rate = ds.video_stream->avg_frame_rate;
+    if (frame_rate.num && frame_rate.den)
+        return av_q2d(av_inv_q(frame_rate));
+    return 1.0 / 30;
+}
+
+// A frame is late when its whole display slot has already passed on the master clock.
+static bool frame_is_late(double pts, double duration)
+{
+    double master = clock_get(&ds.audclk);
+    if (isnan(master) || isnan(pts))
+        return false;
+    double diff = pts + duration - master;
+    return diff < 0 && diff > -NOSYNC_THRESHOLD;
+}
+
+// Runs on the video thread between decode calls, so it may reconfigure the codec.
+static void update_skip_policy(bool late)
+{
+    if (late)
     {
-        int ret = avcodec_send_packet(ds.video_codec_ctx, ds.packet);
+        ds.on_time_frames = 0;
+        if (++ds.late_frames == LATE_FRAMES_SKIP_NONREF && ds.video_codec_ctx->skip_frame < AVDISCARD_NONREF)
+        {
+            TraceLog(LOG_INFO, "Video decoder falling behind, skipping non-reference frames");
+            ds.video_codec_ctx->skip_frame = AVDISCARD_NONREF;
+        }
+    }
+    else
+    {
+        ds.late_frames = 0;
+        if (ds.video_codec_ctx->skip_frame != AVDISCARD_DEFAULT && ++ds.on_time_frames >= ON_TIME_FRAMES_RESUME)
+        {
+            TraceLog(LOG_INFO, "Video decoder caught up, decoding all frames");
+            ds.video_codec_ctx->skip_frame = AVDISCARD_DEFAULT;
+            ds.on_time_frames = 0;
+        }
+    }
+}
+
+// Picks up the size and thread count last requested by the render thread, and
+// rebuilds the scaler only when one of them changed.
+static int update_scaler(void)
+{
+    pthread_mutex_lock(&ds.output_mutex);
+    int width = ds.output_width;
+    int height = ds.output_height;
+    int threads = ds.scale_threads;
+    pthread_mutex_unlock(&ds.output_mutex);
+
+    if (width == ds.scaled_width && height == ds.scaled_height && threads == ds.scaled_threads)
+        return 0;
+    struct SwsContext *sws = create_scaler(width, height, threads);
+    if (!sws)
+    {
+        fprintf(stderr, "ERROR: Could not create SwsContext for %dx%d\n", width, height);
+        return -1;
+    }
+    sws_freeContext(ds.sws_ctx);
+    ds.sws_ctx = sws;
+    ds.scaled_width = width;
+    ds.scaled_height = height;
+    ds.scaled_threads = threads;
+    return 0;
+}
+
+static int convert_frame_rgba(VideoFrame *vf, const AVFrame *frame)
+{
+    if (update_scaler() < 0)
+        return -1;
+    vf->width = ds.scaled_width;
+    vf->height = ds.scaled_height;
+
+    bool same_size = ds.scaled_width == frame->width && ds.scaled_height == frame->height;
+    if (same_size && yuv2rgba(frame, vf->rgba, ds.scaled_width * 4) >= 0)
+        return 0;
+
+    // Only sws_scale_frame() runs the slice threads; sws_scale() stays on this one.
+    AVFrame *dst = ds.rgba_frame;
+    dst->format = AV_PIX_FMT_RGBA;
+    dst->width = ds.scaled_width;
+    dst->height = ds.scaled_height;
+    dst->data[0] = vf->rgba;
+    dst->linesize[0] = ds.scaled_width * 4;
+    int ret = sws_scale_frame(ds.sws_ctx, dst, frame);
+    if (ret < 0)
+        fprintf(stderr, "ERROR: Could not convert frame\n");
+    return ret;
+}
+
+static void *video_thread(void *arg)
+{
+    (void)arg;
+    AVPacket *pkt = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    if (!pkt || !frame)
+    {
+        fprintf(stderr, "ERROR: Could not allocate video decoder buffers\n");
+        goto end;
+    }
+
+    for (;;)
+    {
+        int serial;
+        int status = packet_queue_get(&ds.videoq, pkt, true, &serial);
+        if (status == PACKET_QUEUE_ABORTED)
+            break;
+        if (status == PACKET_QUEUE_FLUSH)
+        {
+            avcodec_flush_buffers(ds.video_codec_ctx);
+            ds.video_trick = trick_play_active();
+            ds.video_codec_ctx->skip_frame = ds.video_trick ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+            ds.late_frames = 0;
+            ds.on_time_frames = 0;
+            ds.video_seek_target = take_seek_target();
+            continue;
+        }
+        if (ds.videoq.nb_packets == 0)
+            wake_demuxer();
+
+        int ret = avcodec_send_packet(ds.video_codec_ctx, pkt);
+        av_packet_unref(pkt);
         if (ret < 0)
         {
             fprintf(stderr, "ERROR: Error sending packet\n");
-            return -1;
+            continue;
         }
+        // A trick play keyframe stands alone: drain it, or a codec with reorder
+        // delay holds it back until later hops push it out, in the wrong order
+        // when rewinding.
+        if (ds.video_trick)
+            avcodec_send_packet(ds.video_codec_ctx, NULL);
 
-        while (ret >= 0)
+        while ((ret = avcodec_receive_frame(ds.video_codec_ctx, frame)) >= 0)
         {
-            ret = avcodec_receive_frame(ds.video_codec_ctx, ds.frame);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-                return -1;
-            else if (ret < 0)
+            // Seeked since this packet was queued: the rest is stale and the
+            // flush marker is next in the queue.
+            if (serial != packet_queue_serial(&ds.videoq))
+            {
+                av_frame_unref(frame);
+                ret = AVERROR(EAGAIN);
+                break;
+            }
+
+            int64_t best_pts = frame->best_effort_timestamp;
+            double pts = best_pts == AV_NOPTS_VALUE ? NAN : best_pts * av_q2d(ds.video_stream->time_base);
+            double duration = frame_duration(frame);
+
+            // Exact seek: frames that end before the target are never shown.
+            if (!isnan(ds.video_seek_target))
+            {
+                if (!isnan(pts) && pts + duration <= ds.video_seek_target + SEEK_EXACT_TOLERANCE)
+                {
+                    av_frame_unref(frame);
+                    continue;
+                }
+                ds.video_seek_target = NAN;
+            }
+
+            // Late frames would be replaced before anyone sees them: skip conversion and upload,
+            // except now and then when nothing else gets through. Trick play runs on the wall
+            // clock and keeps its keyframes-only policy.
+            bool late = !ds.video_trick && frame_is_late(pts, duration);
+            if (!ds.video_trick)
+                update_skip_policy(late);
+            double now = av_gettime_relative() / 1000000.0;
+            if (late && ds.late_frames % LATE_FRAMES_MAX_DROPPED != 0 && now - ds.last_kept_time < LATE_FRAMES_MAX_GAP)
+            {
+                av_frame_unref(frame);
+                continue;
+            }
+            ds.last_kept_time = now;
+
+            VideoFrame *vf = frame_queue_peek_writable(&ds.pictq);
+            if (!vf)
+                goto end;
+
+            // The RGBA path keeps the decoded picture too, for the frame history.
+            // A frame that fails to convert is dropped rather than shown as garbage.
+            if (ds.frame_format == FRAME_FORMAT_RGBA && convert_frame_rgba(vf, frame) < 0)
             {
-                fprintf(stderr, "ERROR: Error receiving frame\n");
-                return -1;
+                av_frame_unref(frame);
+                continue;
             }
+            av_frame_move_ref(vf->frame, frame);
+            vf->pts = pts;
+            vf->duration = duration;
+            vf->serial = serial;
+            frame_queue_push(&ds.pictq);
+        }
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+            fprintf(stderr, "ERROR: Error receiving frame\n");
+        // Drained: the codec takes packets again only after a flush.
+        if (ds.video_trick)
+            avcodec_flush_buffers(ds.video_codec_ctx);
+    }
+
+end:
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    return NULL;
+}
+
+// Converts one decoded frame into resample_buffer and returns the number of
+// output frames. The buffer only grows, so steady-state playback allocates nothing.
+static int resample_audio_frame(AVFrame *frame)
+{
+    int out_samples = swr_get_out_samples(ds.swr_ctx, frame->nb_samples);
+    if (out_samples > ds.resample_capacity)
+    {
+        int size = av_samples_get_buffer_size(NULL, 2, out_samples, AV_SAMPLE_FMT_FLT, 0);
+        uint8_t *buffer = av_realloc(ds.resample_buffer, size);
+        if (!buffer)
+            return AVERROR(ENOMEM);
+        ds.resample_buffer = buffer;
+        ds.resample_capacity = out_samples;
+        ds.audio_allocations++;
+    }
+    ds.audio_frames_resampled++;
+    return swr_convert(ds.swr_ctx, &ds.resample_buffer, ds.resample_capacity,
+                       (const uint8_t *const *)frame->extended_data, frame->nb_samples);
+}
+
+// Called with fifo_mutex held after count samples stretched at speed went into
+// the FIFO.
+static void speed_runs_push(int count, double speed)
+{
+    ds.fifo_media += count * speed / ds.audio_codec_ctx->sample_rate;
+    if (ds.speed_run_count > 0)
+    {
+        SpeedRun *last = &ds.speed_runs[(ds.speed_run_first + ds.speed_run_count - 1) % FIFO_SPEED_RUNS];
+        if (last->speed == speed || ds.speed_run_count == FIFO_SPEED_RUNS)
+        {
+            last->speed = (last->samples * last->speed + count * speed) / (last->samples + count);
+            last->samples += count;
+            return;
+        }
+    }
+    SpeedRun *run = &ds.speed_runs[(ds.speed_run_first + ds.speed_run_count) % FIFO_SPEED_RUNS];
+    run->samples = count;
+    run->speed = speed;
+    ds.speed_run_count++;
+}
 
-            uint8_t *rgba_planes[1] = {ds.rgba_frame_buffer};
-            int rgba_linesizes[1] = {ds.video_codec_ctx->width * 4};
-            sws_scale(ds.sws_ctx, (const uint8_t *const *)ds.frame->data, ds.frame->linesize, 0, ds.video_codec_ctx->height, rgba_planes, rgba_linesizes);
-            UpdateTexture(texture, ds.rgba_frame_buffer);
-            *frame_time = (int)ds.frame->pts * av_q2d(ds.video_stream->time_base);
+// Called with fifo_mutex held after count samples were read from the FIFO.
+// Returns the media time they stood for, in seconds.
+static double speed_runs_pop(int count)
+{
+    double media = 0;
+    while (count > 0 && ds.speed_run_count > 0)
+    {
+        SpeedRun *first = &ds.speed_runs[ds.speed_run_first];
+        int taken = FFMIN(count, first->samples);
+        media += taken * first->speed;
+        first->samples -= taken;
+        count -= taken;
+        if (first->samples == 0)
+        {
+            ds.speed_run_first = (ds.speed_run_first + 1) % FIFO_SPEED_RUNS;
+            ds.speed_run_count--;
         }
     }
-    return 0;
+    media /= ds.audio_codec_ctx->sample_rate;
+    ds.fifo_media = ds.speed_run_count > 0 ? ds.fifo_media - media : 0;
+    return media;
+}
+
+// Returns false once a seek has reset the FIFO for another serial.
+static bool write_audio_fifo(float *samples, int count, double speed, int serial)
+{
+    pthread_mutex_lock(&ds.fifo_mutex);
+    if (serial != ds.fifo_serial)
+    {
+        pthread_mutex_unlock(&ds.fifo_mutex);
+        return false;
+    }
+    if (av_audio_fifo_space(ds.fifo) < count)
+        ds.audio_allocations++;
+    int written = av_audio_fifo_write(ds.fifo, (void **)&samples, count);
+    if (written > 0)
+        speed_runs_push(written, speed);
+    // Audio still inside the stretcher has not reached the FIFO yet.
+    ds.fifo_end_pts = ds.audio_decoded_end - time_stretch_pending(&ds.stretch);
+    pthread_mutex_unlock(&ds.fifo_mutex);
+    return true;
+}
+
+// Picks up a speed set by decoder_set_speed() for the audio decoded from now
+// on. What the FIFO holds plays out at the speed it was stretched at. Back at
+// normal speed, the input the stretcher still holds goes out unstretched.
+static bool update_stretch(int serial)
+{
+    pthread_mutex_lock(&ds.fifo_mutex);
+    double speed = ds.playback_speed;
+    pthread_mutex_unlock(&ds.fifo_mutex);
+    if (speed == ds.stretch.speed)
+        return true;
+    time_stretch_set_speed(&ds.stretch, speed);
+    if (speed != 1.0)
+        return true;
+
+    if (ds.stretch.input_count == 0)
+    {
+        time_stretch_reset(&ds.stretch);
+        return true;
+    }
+    float *samples;
+    int count = time_stretch_drain(&ds.stretch, &samples);
+    return count <= 0 || write_audio_fifo(samples, count, 1.0, serial);
 }
 
-int decoder_fill_audio_queue(Texture texture, int64_t *frame_time)
+// Frames are written only while serial is still the FIFO's; once a seek has
+// reset it, the remaining output of this packet is dropped.
+static void decode_audio_packet(AVPacket *packet, int serial)
 {
-    while (av_audio_fifo_size(ds.fifo) < FIFO_MIN_FRAMES)
+    if (avcodec_send_packet(ds.audio_codec_ctx, packet) != 0)
+    {
+        fprintf(stderr, "ERROR: Error sending packet\n");
+        return;
+    }
+    while (avcodec_receive_frame(ds.audio_codec_ctx, ds.frame) == 0)
     {
-        if (av_read_frame(ds.format_ctx, ds.packet) == 0 && ds.packet->stream_index == ds.audio_stream_idx)
+        int nb_samples = resample_audio_frame(ds.frame);
+        if (nb_samples <= 0)
         {
-            if (avcodec_send_packet(ds.audio_codec_ctx, ds.packet) != 0)
+            av_frame_unref(ds.frame);
+            continue;
+        }
+
+        // Exact seek: drop whole frames before the target and trim the one that spans it.
+        int skip = 0;
+        if (!isnan(ds.audio_seek_target) && ds.frame->pts != AV_NOPTS_VALUE)
+        {
+            double start = ds.frame->pts * av_q2d(ds.audio_stream->time_base);
+            skip = FFMAX(0, (int)lrint((ds.audio_seek_target - start) * ds.audio_codec_ctx->sample_rate));
+            if (skip >= nb_samples)
             {
-                fprintf(stderr, "ERROR: Error sending packet\n");
+                av_frame_unref(ds.frame);
                 continue;
             }
-            while (avcodec_receive_frame(ds.audio_codec_ctx, ds.frame) == 0)
+        }
+        ds.audio_seek_target = NAN;
+
+        if (!update_stretch(serial))
+        {
+            av_frame_unref(ds.frame);
+            break;
+        }
+
+        double duration = (double)nb_samples / ds.audio_codec_ctx->sample_rate;
+        if (ds.frame->pts != AV_NOPTS_VALUE)
+            ds.audio_decoded_end = ds.frame->pts * av_q2d(ds.audio_stream->time_base) + duration;
+        else if (!isnan(ds.audio_decoded_end))
+            ds.audio_decoded_end += duration;
+
+        float *samples = (float *)ds.resample_buffer + skip * 2;
+        int count = nb_samples - skip;
+        double speed = ds.stretch.speed;
+        if (speed != 1.0)
+            count = time_stretch_process(&ds.stretch, samples, count, &samples);
+        av_frame_unref(ds.frame);
+        if (count < 0)
+            continue;
+        if (!write_audio_fifo(samples, count, speed, serial))
+            break;
+    }
+}
+
+static void *audio_thread(void *arg)
+{
+    (void)arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&ds.fifo_mutex);
+        while (!ds.abort_request && av_audio_fifo_size(ds.fifo) >= ds.fifo_low_watermark)
+            pthread_cond_wait(&ds.fifo_cond, &ds.fifo_mutex);
+        pthread_mutex_unlock(&ds.fifo_mutex);
+
+        for (;;)
+        {
+            pthread_mutex_lock(&ds.fifo_mutex);
+            int buffered = av_audio_fifo_size(ds.fifo);
+            pthread_mutex_unlock(&ds.fifo_mutex);
+            if (buffered >= ds.fifo_high_watermark)
+                break;
+
+            int serial;
+            int status = packet_queue_get(&ds.audioq, ds.packet, true, &serial);
+            if (status == PACKET_QUEUE_ABORTED)
+                return NULL;
+            if (status == PACKET_QUEUE_FLUSH)
             {
-                AVFrame *resampled_frame = av_frame_alloc();
-                resampled_frame->sample_rate = ds.audio_codec_ctx->sample_rate;
-                AVChannelLayout out_ch_layout;
-                av_channel_layout_default(&out_ch_layout, 2);
-                av_channel_layout_copy(&resampled_frame->ch_layout, &out_ch_layout);
-
-                resampled_frame->format = AV_SAMPLE_FMT_FLT;
-                resampled_frame->nb_samples = ds.frame->nb_samples;
-
-                swr_convert_frame(ds.swr_ctx, resampled_frame, ds.frame);
-                av_audio_fifo_write(ds.fifo, (void **)resampled_frame->data, resampled_frame->nb_samples);
-                av_frame_free(&resampled_frame);
+                // The FIFO was reset by the seek; drop what codec and resampler still hold.
+                avcodec_flush_buffers(ds.audio_codec_ctx);
+                swr_init(ds.swr_ctx);
+                time_stretch_reset(&ds.stretch);
+                ds.audio_decoded_end = NAN;
+                ds.audio_seek_target = take_seek_target();
+                continue;
             }
+            if (ds.audioq.nb_packets == 0)
+                wake_demuxer();
+            decode_audio_packet(ds.packet, serial);
+            av_packet_unref(ds.packet);
+        }
+    }
+}
+
+// ds.frame_format must be final by now, and for RGBA the renderer must have
+// given every pictq slot its pixel memory.
+int decoder_start(void)
+{
+    if (ds.frame_format == FRAME_FORMAT_RGBA)
+        TraceLog(LOG_INFO, "Video: RGBA conversion with %s",
+                 yuv2rgba_supported(ds.video_codec_ctx->pix_fmt) ? yuv2rgba_kernel_name() : "sws_scale");
+    TraceLog(LOG_INFO, "Audio: time-stretch with %s kernel", time_stretch_kernel_name());
+
+    if (pthread_create(&ds.demux_thread, NULL, demux_thread, NULL) != 0)
+    {
+        fprintf(stderr, "ERROR: Could not start demuxer thread\n");
+        return -1;
+    }
+    ds.demux_running = true;
+
+    if (pthread_create(&ds.video_thread, NULL, video_thread, NULL) != 0)
+    {
+        fprintf(stderr, "ERROR: Could not start video decoder thread\n");
+        return -1;
+    }
+    ds.video_running = true;
+
+    if (pthread_create(&ds.audio_thread, NULL, audio_thread, NULL) != 0)
+    {
+        fprintf(stderr, "ERROR: Could not start audio decoder thread\n");
+        return -1;
+    }
+    ds.audio_running = true;
+    return 0;
+}
+
+void decoder_set_audio_watermarks(int low, int high)
+{
+    pthread_mutex_lock(&ds.fifo_mutex);
+    ds.fifo_low_watermark = low;
+    ds.fifo_high_watermark = high > low ? high : low;
+    pthread_cond_signal(&ds.fifo_cond);
+    pthread_mutex_unlock(&ds.fifo_mutex);
+}
+
+// Runs on the audio device thread. Pads with silence on underrun and wakes the
+// audio decoder once the FIFO drops below the low watermark. Also advances the
+// master clock: the samples handed over here become audible after the buffer
+// the device is already playing, so the clock trails them by one callback.
+// Stretched samples each stand for speed samples of media time, at the speed
+// they were stretched at, and the clock runs at that speed until the next call.
+int decoder_read_audio(void *buffer, int frames)
+{
+    double sample_rate = ds.audio_codec_ctx->sample_rate;
+
+    pthread_mutex_lock(&ds.fifo_mutex);
+    double start_pts = ds.fifo_end_pts - ds.fifo_media;
+    int read = av_audio_fifo_read(ds.fifo, &buffer, frames);
+    if (read < 0)
+        read = 0;
+    double media = speed_runs_pop(read);
+    if (av_audio_fifo_size(ds.fifo) < ds.fifo_low_watermark)
+        pthread_cond_signal(&ds.fifo_cond);
+    pthread_mutex_unlock(&ds.fifo_mutex);
+
+    if (read > 0 && !isnan(start_pts))
+    {
+        double speed = media * sample_rate / read;
+        double latency = frames * speed / sample_rate;
+        clock_set_speed(&ds.audclk, speed);
+        clock_set(&ds.audclk, start_pts - latency, start_pts + media - latency);
+    }
+
+    if (read < frames)
+        memset((float *)buffer + read * 2, 0, (frames - read) * sizeof(float) * 2);
+    return read;
+}
+
+// Called by the render thread with the on-screen size of the picture. The
+// source aspect ratio is kept and pictures are never scaled up on the CPU,
+// since the GPU stretches them for free.
+void decoder_set_output_size(int width, int height)
+{
+    int source_width = ds.video_codec_ctx->width;
+    int source_height = ds.video_codec_ctx->height;
+    double scale = FFMIN((double)width / source_width, (double)height / source_height);
+    if (!(scale < 1.0))
+        scale = 1.0;
+    width = FFMAX(1, (int)lrint(source_width * scale));
+    height = FFMAX(1, (int)lrint(source_height * scale));
+
+    pthread_mutex_lock(&ds.output_mutex);
+    ds.output_width = width;
+    ds.output_height = height;
+    pthread_mutex_unlock(&ds.output_mutex);
+}
+
+// Takes effect on the next converted frame; 0 means one thread per core.
+void decoder_set_scale_threads(int threads)
+{
+    pthread_mutex_lock(&ds.output_mutex);
+    ds.scale_threads = FFMAX(0, threads);
+    pthread_mutex_unlock(&ds.output_mutex);
+}
+
+// Resuming after the picture was stepped or taken from the history seeks to the
+// frame on screen, so audio and the decoders continue from there.
+void decoder_set_paused(bool paused)
+{
+    clock_set_paused(&ds.audclk, paused);
+    if (!paused && ds.history_dirty)
+        decoder_seek((int64_t)(frame_time / av_q2d(ds.video_stream->time_base)), DECODER_SEEK_EXACT);
+}
+
+// Audio keeps its pitch through the time-stretcher, which the audio thread
+// moves to the new speed for what it decodes next. The audio already in the
+// FIFO plays out at the old speed, and the clock follows it there, so the new
+// speed is heard and seen once that has played; video keeps its queues and is
+// simply presented against the clock.
+void decoder_set_speed(double speed)
+{
+    speed = av_clipd(speed, MIN_PLAYBACK_SPEED, MAX_PLAYBACK_SPEED);
+    pthread_mutex_lock(&ds.fifo_mutex);
+    ds.playback_speed = speed;
+    pthread_mutex_unlock(&ds.fifo_mutex);
+}
+
+// Fast forward (speed > 0) or rewind (speed < 0) through keyframes alone: the
+// demuxer hops from one to the next speed / TRICK_FRAMES_PER_SECOND seconds
+// on, the decoder drops everything else, and they are shown at a steady
+// TRICK_FRAMES_PER_SECOND with audio muted. 0 resumes normal playback at the
+// frame on screen. Both ways start with a seek, which flushes the pipeline.
+void decoder_set_trick_speed(int speed)
+{
+    if (speed == ds.trick_speed)
+        return;
+    pthread_mutex_lock(&ds.demux_mutex);
+    ds.trick_speed = speed;
+    pthread_mutex_unlock(&ds.demux_mutex);
+    decoder_seek((int64_t)(frame_time / av_q2d(ds.video_stream->time_base)), speed ? 0 : DECODER_SEEK_EXACT);
+}
+
+// The seek itself runs on the demuxer thread; decoders flush when they reach the marker it queues.
+// A request still pending is replaced, so scrubbing costs one seek per demuxer iteration.
+void decoder_seek(int64_t seek_target, int flags)
+{
+    ds.history_dirty = false;
+    // Playing backwards carries on from the new position.
+    if (ds.reverse_speed > 0)
+    {
+        reverse_decoder_restart(&ds.reverse, seek_target * av_q2d(ds.video_stream->time_base));
+        ds.reverse_index = -1;
+    }
+    pthread_mutex_lock(&ds.demux_mutex);
+    ds.seek_pos = seek_target;
+    ds.seek_flags = flags;
+    ds.seek_req = true;
+    pthread_cond_signal(&ds.continue_read_cond);
+    pthread_mutex_unlock(&ds.demux_mutex);
+}
+
+void decoder_close(void)
+{
+    if (ds.demux_running)
+    {
+        pthread_mutex_lock(&ds.demux_mutex);
+        ds.abort_request = true;
+        pthread_cond_signal(&ds.continue_read_cond);
+        pthread_mutex_unlock(&ds.demux_mutex);
+        packet_queue_abort(&ds.audioq);
+        packet_queue_abort(&ds.videoq);
+        pthread_join(ds.demux_thread, NULL);
+        ds.demux_running = false;
+    }
+    if (ds.video_running)
+    {
+        packet_queue_abort(&ds.videoq);
+        frame_queue_abort(&ds.pictq);
+        pthread_join(ds.video_thread, NULL);
+        ds.video_running = false;
+    }
+    if (ds.audio_running)
+    {
+        pthread_mutex_lock(&ds.fifo_mutex);
+        pthread_cond_signal(&ds.fifo_cond);
+        pthread_mutex_unlock(&ds.fifo_mutex);
+        packet_queue_abort(&ds.audioq);
+        pthread_join(ds.audio_thread, NULL);
+        ds.audio_running = false;
+    }
+    if (ds.has_reverse)
+    {
+        reverse_decoder_close(&ds.reverse);
+        ds.has_reverse = false;
+    }
+    frame_queue_destroy(&ds.pictq);
+    packet_queue_destroy(&ds.audioq);
+    packet_queue_destroy(&ds.videoq);
+    pthread_mutex_destroy(&ds.demux_mutex);
+    pthread_cond_destroy(&ds.continue_read_cond);
+
+    av_packet_free(&ds.packet);
+    av_frame_free(&ds.frame);
+    sws_freeContext(ds.sws_ctx);
+    sws_freeContext(ds.history_sws_ctx);
+    av_freep(&ds.history_rgba);
+    av_frame_free(&ds.rgba_frame);
+    pthread_mutex_destroy(&ds.output_mutex);
+    av_audio_fifo_free(ds.fifo);
+    pthread_mutex_destroy(&ds.fifo_mutex);
+    pthread_cond_destroy(&ds.fifo_cond);
+    clock_destroy(&ds.audclk);
+    TraceLog(LOG_INFO, "Audio resampler: %d allocations over %lld frames", ds.audio_allocations,
+             (long long)ds.audio_frames_resampled);
+    swr_free(&ds.swr_ctx);
+    av_freep(&ds.resample_buffer);
+    time_stretch_free(&ds.stretch);
+    frame_history_destroy(&ds.history);
+    avcodec_free_context(&ds.video_codec_ctx);
+    avcodec_free_context(&ds.audio_codec_ctx);
+    if (ds.frame_pool)
+    {
+        frame_pool_log_stats(ds.frame_pool, "Video");
+        frame_pool_release(ds.frame_pool);
+        ds.frame_pool = NULL;
+    }
+    if (ds.has_keyframe_index)
+        keyframe_index_close(&ds.keyframes);
+    avformat_close_input(&ds.format_ctx);
+    if (ds.input_backend == INPUT_READAHEAD)
+        readahead_io_close(&ds.readahead);
+    else if (ds.input_backend == INPUT_MMAP)
+        mmap_io_close(&ds.mmap_input);
+    else if (ds.input_backend == INPUT_URING)
+        uring_io_close(&ds.uring_input);
+    ds.input_backend = INPUT_AVIO;
+}
+
+// Records the frame at the head of pictq in the history and releases the slot.
+// A new serial means a seek: the history no longer leads up to this frame, so
+// it starts over.
+static void record_queued_frame(VideoFrame *vf, double *frame_time)
+{
+    if (vf->serial != ds.history_serial)
+    {
+        frame_history_clear(&ds.history);
+        ds.history_serial = vf->serial;
+    }
+
+    if (!isnan(vf->pts))
+        *frame_time = vf->pts;
+    if (vf->frame->buf[0] && !isnan(vf->pts))
+        frame_history_push(&ds.history, vf->frame, vf->pts, vf->duration);
+    ds.history_age = 0;
+    frame_queue_next(&ds.pictq);
+}
+
+static void show_queued_frame(VideoRenderer *renderer, VideoFrame *vf, double *frame_time)
+{
+    renderer_upload(renderer, vf);
+    record_queued_frame(vf, frame_time);
+}
+
+// Uploads a frame that did not come through pictq. The RGBA path converts it
+// here, on the render thread, at its full size.
+static void show_decoded_frame(VideoRenderer *renderer, const AVFrame *frame)
+{
+    if (ds.frame_format != FRAME_FORMAT_RGBA)
+    {
+        renderer_upload_frame(renderer, frame);
+        return;
+    }
+    size_t size = (size_t)frame->width * frame->height * 4;
+    if (size > ds.history_rgba_size)
+    {
+        // Frames in the history can be larger than the ones before them.
+        av_freep(&ds.history_rgba);
+        ds.history_rgba_size = 0;
+        ds.history_rgba = av_malloc(size);
+        if (!ds.history_rgba)
+            return;
+        ds.history_rgba_size = size;
+    }
+    if (yuv2rgba(frame, ds.history_rgba, frame->width * 4) < 0)
+    {
+        ds.history_sws_ctx = sws_getCachedContext(ds.history_sws_ctx, frame->width, frame->height, frame->format,
+                                                  frame->width, frame->height, AV_PIX_FMT_RGBA, SWS_BICUBIC, NULL,
+                                                  NULL, NULL);
+        if (!ds.history_sws_ctx)
+            return;
+        int linesize = frame->width * 4;
+        sws_scale(ds.history_sws_ctx, (const uint8_t *const *)frame->data, frame->linesize, 0, frame->height,
+                  &ds.history_rgba, &linesize);
+    }
+    renderer_upload_pixels(renderer, ds.history_rgba, frame->width, frame->height);
+}
+
+static void show_history_frame(VideoRenderer *renderer, HistoryFrame *hf, double *frame_time)
+{
+    show_decoded_frame(renderer, hf->frame);
+    *frame_time = hf->pts;
+}
+
+// Wall-clock time a frame stays up when video is not following the audio clock.
+static double display_duration(const VideoFrame *vf)
+{
+    if (ds.trick_speed)
+        return 1.0 / TRICK_FRAMES_PER_SECOND;
+    return vf->duration / ds.playback_speed;
+}
+
+// Shows the frame that is due now against the audio clock, if any. The frame on
+// screen is repeated while the next one is early, and frames whose successor is
+// already due are dropped without uploading them. Until audio is playing, frames
+// are paced by their durations on the wall clock.
+int decoder_present_frame(VideoRenderer *renderer, double *frame_time)
+{
+    double now = av_gettime_relative() / 1000000.0;
+    double master = clock_get(&ds.audclk);
+    VideoFrame *vf;
+
+    while ((vf = frame_queue_peek(&ds.pictq)))
+    {
+        if (vf->serial != ds.pictq_serial)
+        {
+            // First frame after a seek: show it straight away.
+            ds.pictq_serial = vf->serial;
+            ds.frame_timer = 0;
+            ds.last_duration = 0;
         }
-        if (ds.packet->stream_index == ds.video_stream_idx)
+        VideoFrame *next = frame_queue_peek_next(&ds.pictq);
+
+        if (!isnan(master) && !isnan(vf->pts) && fabs(vf->pts - master) < NOSYNC_THRESHOLD)
         {
-            int ret = avcodec_send_packet(ds.video_codec_ctx, ds.packet);
-            if (ret < 0)
+            if (vf->pts - master > SYNC_EARLY_TOLERANCE)
+                return 0;
+            if (next && !isnan(next->pts) && next->pts - master <= SYNC_EARLY_TOLERANCE)
             {
-                fprintf(stderr, "ERROR: Error sending packet\n");
-                return -1;
+                frame_queue_next(&ds.pictq);
+                continue;
             }
-    
-            while (ret >= 0)
+            ds.frame_timer = now;
+        }
+        else
+        {
+            if (now < ds.frame_timer + ds.last_duration)
+                return 0;
+            ds.frame_timer += ds.last_duration;
+            if (now - ds.frame_timer > FRAME_RESYNC_THRESHOLD)
+                ds.frame_timer = now;
+            if (next && now >= ds.frame_timer + display_duration(vf))
             {
-                ret = avcodec_receive_frame(ds.video_codec_ctx, ds.frame);
-                if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-                    return -1;
-                else if (ret < 0)
-                {
-                    fprintf(stderr, "ERROR: Error receiving frame\n");
-                    return -1;
-                }
-    
-                uint8_t *rgba_planes[1] = {ds.rgba_frame_buffer};
-                int rgba_linesizes[1] = {ds.video_codec_ctx->width * 4};
-                sws_scale(ds.sws_ctx, (const uint8_t *const *)ds.frame->data, ds.frame->linesize, 0, ds.video_codec_ctx->height, rgba_planes, rgba_linesizes);
-                UpdateTexture(texture, ds.rgba_frame_buffer);
-                *frame_time = (int)ds.frame->pts * av_q2d(ds.video_stream->time_base);
+                ds.last_duration = display_duration(vf);
+                frame_queue_next(&ds.pictq);
+                continue;
             }
         }
+        ds.last_duration = display_duration(vf);
+        show_queued_frame(renderer, vf, frame_time);
+        return 1;
     }
-    av_packet_unref(ds.packet);
     return 0;
 }
+
+// Steps one frame back through the history, or one forward: through the history
+// first, then by taking the next decoded frame regardless of the clock. Meant for
+// while playback is paused; returns false when there is no frame to step to.
+bool decoder_step_frame(VideoRenderer *renderer, int direction, double *frame_time)
+{
+    int age = ds.history_age - direction;
+    HistoryFrame *hf = frame_history_get(&ds.history, age);
+    if (hf)
+    {
+        show_history_frame(renderer, hf, frame_time);
+        ds.history_age = age;
+        ds.history_dirty = true;
+        return true;
+    }
+    if (direction < 0 || age > 0)
+        return false;
+
+    // After reverse play the queue starts over at the frame already on screen.
+    VideoFrame *vf = frame_queue_peek(&ds.pictq);
+    if (vf && ds.history.count == 0 && !isnan(vf->pts) && vf->pts <= *frame_time)
+    {
+        record_queued_frame(vf, frame_time);
+        vf = frame_queue_peek(&ds.pictq);
+    }
+    if (!vf)
+        return false;
+    ds.pictq_serial = vf->serial;
+    show_queued_frame(renderer, vf, frame_time);
+    ds.history_dirty = true;
+    return true;
+}
+
+// Shows the frame at time from the history without involving the demuxer.
+// Returns false when the history does not reach back to it.
+bool decoder_seek_history(VideoRenderer *renderer, double time, double *frame_time)
+{
+    if (ds.reverse_speed > 0)
+        return false;
+    int age = frame_history_find(&ds.history, time);
+    if (age < 0)
+        return false;
+    show_history_frame(renderer, frame_history_get(&ds.history, age), frame_time);
+    ds.history_age = age;
+    ds.history_dirty = true;
+    return true;
+}
+
+void decoder_set_history_budget(int megabytes)
+{
+    frame_history_set_budget(&ds.history, (size_t)FFMAX(0, megabytes) * 1024 * 1024);
+    ds.history_age = FFMIN(ds.history_age, FFMAX(0, ds.history.count - 1));
+}
+
+// Reverse frames never go into the history, so frame stepping carries on from
+// the frame on screen only when the history reaches back to it. Otherwise the
+// history is dropped and the paused pipeline sent there, for stepping forward.
+static void anchor_history(void)
+{
+    int age = frame_history_find(&ds.history, frame_time);
+    if (age >= 0)
+    {
+        ds.history_age = age;
+        return;
+    }
+    frame_history_clear(&ds.history);
+    ds.history_age = 0;
+    decoder_seek((int64_t)(frame_time / av_q2d(ds.video_stream->time_base)), DECODER_SEEK_EXACT);
+}
+
+// speed > 0 plays backwards from the frame on screen, or changes the speed when
+// already doing so; 0 stops. The forward pipeline must be paused meanwhile: it
+// resumes with a seek to the frame shown last. Returns false when reverse
+// playback is unavailable.
+bool decoder_set_reverse(double speed)
+{
+    if (!ds.has_reverse)
+        return false;
+    double now = av_gettime_relative() / 1000000.0;
+    if (speed <= 0)
+    {
+        if (ds.reverse_speed > 0)
+        {
+            reverse_decoder_stop(&ds.reverse);
+            ds.reverse_speed = 0;
+            anchor_history();
+        }
+        return true;
+    }
+    if (ds.reverse_speed > 0)
+    {
+        ds.reverse_origin -= (now - ds.reverse_wall) * ds.reverse_speed;
+    }
+    else
+    {
+        reverse_decoder_restart(&ds.reverse, frame_time);
+        ds.reverse_index = -1;
+        ds.reverse_origin = frame_time;
+    }
+    ds.reverse_wall = now;
+    ds.reverse_speed = FFMIN(speed, REVERSE_MAX_SPEED);
+    return true;
+}
+
+// The reverse clock stands still on time until the next GOP is decoded.
+static void hold_reverse_clock(double time, double now)
+{
+    ds.reverse_origin = time;
+    ds.reverse_wall = now;
+}
+
+// Shows the frame due on the reverse clock, if it is not on screen already.
+// Frames whose slot passed while the render thread was busy are skipped, as
+// is the rest of a GOP once the one before it is due. Returns 1 when a frame
+// was shown and -1 once the first frame of the file is on screen.
+int decoder_present_reverse(VideoRenderer *renderer, double *frame_time)
+{
+    double now = av_gettime_relative() / 1000000.0;
+    double target = ds.reverse_origin - (now - ds.reverse_wall) * ds.reverse_speed;
+    bool has_next = false;
+    ReverseGop *gop;
+
+    while ((gop = reverse_decoder_peek(&ds.reverse, &has_next)))
+    {
+        if (ds.reverse_index < 0)
+            ds.reverse_index = gop->count;
+        if (target >= gop->pts[0] || !has_next)
+            break;
+        reverse_decoder_next(&ds.reverse);
+        ds.reverse_index = -1;
+    }
+    if (!gop)
+    {
+        if (reverse_decoder_at_start(&ds.reverse))
+            return -1;
+        hold_reverse_clock(*frame_time, now);
+        return 0;
+    }
+
+    int shown = ds.reverse_index;
+    if (shown == 0)
+    {
+        if (target >= gop->pts[0])
+            return 0;
+        if (reverse_decoder_at_start(&ds.reverse))
+            return -1;
+        hold_reverse_clock(gop->pts[0], now);
+        return 0;
+    }
+    if (shown < gop->count && target >= gop->pts[shown])
+        return 0;
+
+    // The frame due is the latest one that starts at or before the clock.
+    int i = shown - 1;
+    while (i > 0 && gop->pts[i] > target)
+        i--;
+    ds.reverse_index = i;
+    show_decoded_frame(renderer, gop->frames[i]);
+    *frame_time = gop->pts[i];
+    ds.history_dirty = true;
+    return 1;
+}
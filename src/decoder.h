@@ -2,6 +2,7 @@
 #define DECODER_H
 
 #include <stdbool.h>
+#include <pthread.h>
 #include <libavutil/opt.h>
 #include <libavcodec/avcodec.h>
 #include <libswscale/swscale.h>
@@ -10,10 +11,76 @@
 #include <libswresample/swresample.h>
 
 #include "raylib.h"
+#include "packet_queue.h"
+#include "frame_queue.h"
+#include "clock.h"
+#include "renderer.h"
+#include "frame_pool.h"
+#include "keyframe_index.h"
+#include "frame_history.h"
+#include "reverse_decoder.h"
+#include "time_stretch.h"
+#include "readahead_io.h"
+#include "mmap_io.h"
+#include "uring_io.h"
+
+// Audio FIFO watermarks, in sample frames. The audio thread sleeps until the
+// device drains the FIFO below the low mark, then refills it to the high mark.
+#define FIFO_LOW_WATERMARK (1024 * 8)
+#define FIFO_HIGH_WATERMARK (1024 * 32)
+// Runs of samples at one speed the FIFO keeps track of; speed changes beyond
+// that while it is full are folded into the newest run.
+#define FIFO_SPEED_RUNS 16
+
+// Default memory budget of the displayed-frame history behind frame stepping.
+// The AVP_HISTORY_MB environment variable overrides it; 0 turns the history off.
+#define HISTORY_BUDGET_MB 256
+
+// Playback speed range; audio is time-stretched to keep its pitch.
+#define MIN_PLAYBACK_SPEED 0.5
+#define MAX_PLAYBACK_SPEED 4.0
+
+// Trick play shows keyframes only, at this steady rate whatever the speed, up
+// to TRICK_MAX_SPEED times normal speed in either direction.
+#define TRICK_FRAMES_PER_SECOND 10
+#define TRICK_MIN_SPEED 8
+#define TRICK_MAX_SPEED 64
+
+// Fastest reverse playback; each step up doubles the speed.
+#define REVERSE_MAX_SPEED 4.0
+
+// How decoder_init() reads the file. Local files are mapped, except very large
+// ones, which are read through io_uring around the page cache; files on network
+// filesystems go through the read-ahead thread. The AVP_INPUT environment
+// variable ("avio", "readahead", "mmap" or "io_uring") overrides the choice.
+// Samples in the audio FIFO that were all stretched at the same speed.
+struct SpeedRun
+{
+    int samples;
+    double speed; // media time per sample, in sample periods
+};
+
+typedef struct SpeedRun SpeedRun;
+
+enum InputBackend
+{
+    INPUT_AVIO, // whatever protocol FFmpeg picks
+    INPUT_READAHEAD,
+    INPUT_MMAP,
+    INPUT_URING,
+};
+
+// decoder_seek() flag, next to the AVSEEK_FLAG_* ones: decode forward from the
+// keyframe and start output at the exact target instead of at the keyframe.
+#define DECODER_SEEK_EXACT 0x10000
 
 struct DecoderState
 {
     AVFormatContext *format_ctx;
+    enum InputBackend input_backend; // custom I/O under format_ctx, unless INPUT_AVIO
+    ReadaheadIO readahead;
+    MmapIO mmap_input;
+    UringIO uring_input;
     AVCodecContext *video_codec_ctx;
     AVCodecContext *audio_codec_ctx;
     int audio_stream_idx;
@@ -25,17 +92,117 @@ struct DecoderState
     SwrContext *swr_ctx;
     struct SwsContext *sws_ctx;
     AVAudioFifo *fifo;
+    uint8_t *resample_buffer; // interleaved stereo float, reused for every audio frame
+    int resample_capacity;    // in sample frames
+    int audio_allocations;    // resample buffer and FIFO growths since open
+    int64_t audio_frames_resampled;
     AVDictionaryEntry *tag;
 
-    uint8_t *rgba_frame_buffer;
+    FrameFormat frame_format;
+    FramePool *frame_pool; // backs video_codec_ctx's get_buffer2
+
+    // RGBA path: pictures are scaled on the CPU to the size they are displayed at,
+    // never above the source size. The render thread requests a size, the video
+    // thread rebuilds sws_ctx for it before converting the next frame.
+    pthread_mutex_t output_mutex;
+    int output_width; // requested by decoder_set_output_size()
+    int output_height;
+    int scale_threads; // slice threads requested by decoder_set_scale_threads()
+    int scaled_width;  // what sws_ctx currently produces
+    int scaled_height;
+    int scaled_threads;
+    AVFrame *rgba_frame; // wraps the queue slot sws_ctx converts into
+
+    // Demuxer thread: sole owner of format_ctx once decoder_start() has run
+    PacketQueue audioq;
+    PacketQueue videoq;
+    pthread_t demux_thread;
+    pthread_mutex_t demux_mutex;
+    pthread_cond_t continue_read_cond;
+    bool demux_running;
+    bool abort_request;
+    bool eof;
+    bool seek_req;
+    int64_t seek_pos; // in video stream time base
+    int seek_flags;
+    double seek_target; // seconds, for the decoders to skip to after the next flush; NAN for none
+    int trick_speed; // keyframe-only fast forward (> 0) or rewind (< 0); 0 for normal playback
+    KeyframeIndex keyframes; // byte offsets for containers without an index of their own
+    bool has_keyframe_index;
+
+    // Video decode thread fills pictq; the render thread only presents from it
+    FrameQueue pictq;
+    pthread_t video_thread;
+    bool video_running;
+    int late_frames;      // consecutive frames that were late before conversion
+    int on_time_frames;   // consecutive frames decoded in time, while skipping
+    double last_kept_time; // wall clock when a frame last went on to pictq, seconds
+    double video_seek_target; // seconds; frames ending before it are discarded unseen
+    bool video_trick;         // trick play since the last flush: keyframes only, never late
+    int pictq_serial;     // serial of the frame on screen
+    double frame_timer;   // wall-clock time the frame on screen was due
+    double last_duration; // wall-clock time the frame on screen stays up
+
+    // Frames already shown, for stepping back and short backward seeks while paused
+    FrameHistory history;
+    int history_age;    // frame on screen, counted back from the newest; 0 when live
+    int history_serial; // pictq serial the history frames belong to
+    bool history_dirty; // the picture moved while paused; playback resumes with a seek to it
+    struct SwsContext *history_sws_ctx; // RGBA path: converts history frames on the render thread
+    uint8_t *history_rgba;
+    size_t history_rgba_size;
+
+    // Reverse playback: GOPs decoded backwards by a decoder of its own and shown
+    // back to front on a clock that runs down from where it started
+    ReverseDecoder reverse;
+    bool has_reverse;
+    double reverse_speed;  // 0 when not playing backwards
+    double reverse_origin; // media time the reverse clock showed at reverse_wall, seconds
+    double reverse_wall;
+    int reverse_index; // frame on screen in the front GOP, or its count while none is; -1 for a GOP not looked at yet
+
+    // Audio decode thread refills fifo when audio_callback() drains it
+    pthread_t audio_thread;
+    bool audio_running;
+    pthread_mutex_t fifo_mutex;
+    pthread_cond_t fifo_cond;
+    int fifo_low_watermark;
+    int fifo_high_watermark;
+    double fifo_end_pts; // pts just past the last sample in fifo, seconds
+    int fifo_serial;     // audioq serial the samples in fifo belong to
+    double audio_seek_target; // seconds; samples before it are dropped
+    double audio_decoded_end; // pts just past the last sample decoded, seconds
+    SpeedRun speed_runs[FIFO_SPEED_RUNS]; // ring over the samples in fifo, oldest first
+    int speed_run_first;
+    int speed_run_count;
+    double fifo_media;     // media time the samples in fifo stand for, seconds
+    double playback_speed; // set by decoder_set_speed(); guarded by fifo_mutex
+    TimeStretch stretch;   // between the resampler and fifo, when its speed is not 1
+
+    // Master clock: driven by the samples audio_callback() hands to the device
+    Clock audclk;
 };
 
 typedef struct DecoderState DecoderState;
 extern DecoderState ds;
-extern int64_t frame_time;
+extern double frame_time;
 
 int decoder_init(char *filename);
-int decoder_decode_frame(Texture texture, int64_t *frame_time);
-int decoder_fill_audio_queue(Texture texture, int64_t *frame_time);
+int decoder_start(void);
+void decoder_seek(int64_t seek_target, int flags);
+bool decoder_seek_history(VideoRenderer *renderer, double time, double *frame_time);
+bool decoder_step_frame(VideoRenderer *renderer, int direction, double *frame_time);
+void decoder_set_history_budget(int megabytes);
+bool decoder_set_reverse(double speed);
+int decoder_present_reverse(VideoRenderer *renderer, double *frame_time);
+void decoder_set_paused(bool paused);
+void decoder_set_speed(double speed);
+void decoder_set_trick_speed(int speed);
+void decoder_set_output_size(int width, int height);
+void decoder_set_scale_threads(int threads);
+void decoder_close(void);
+int decoder_present_frame(VideoRenderer *renderer, double *frame_time);
+void decoder_set_audio_watermarks(int low, int high);
+int decoder_read_audio(void *buffer, int frames);
 
 #endif // DECODER_H
@@ -0,0 +1,78 @@
+#include "frame_history.h"
+
+#include <string.h>
+
+void frame_history_init(FrameHistory *h, size_t budget)
+{
+    memset(h, 0, sizeof(*h));
+    h->budget = budget;
+}
+
+static void drop_oldest(FrameHistory *h)
+{
+    HistoryFrame *hf = &h->frames[h->start];
+    av_frame_free(&hf->frame);
+    h->bytes -= hf->size;
+    h->start = (h->start + 1) % FRAME_HISTORY_MAX_FRAMES;
+    h->count--;
+}
+
+void frame_history_clear(FrameHistory *h)
+{
+    while (h->count > 0)
+        drop_oldest(h);
+}
+
+void frame_history_destroy(FrameHistory *h)
+{
+    frame_history_clear(h);
+}
+
+void frame_history_set_budget(FrameHistory *h, size_t budget)
+{
+    h->budget = budget;
+    while (h->count > 0 && h->bytes > h->budget)
+        drop_oldest(h);
+}
+
+// Evicts from the old end until the new frame fits the budget.
+void frame_history_push(FrameHistory *h, const AVFrame *frame, double pts, double duration)
+{
+    size_t size = 0;
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++)
+        size += frame->buf[i]->size;
+    if (size == 0 || size > h->budget)
+        return;
+
+    while (h->count > 0 && (h->count == FRAME_HISTORY_MAX_FRAMES || h->bytes + size > h->budget))
+        drop_oldest(h);
+
+    AVFrame *ref = av_frame_clone(frame);
+    if (!ref)
+        return;
+    h->frames[(h->start + h->count) % FRAME_HISTORY_MAX_FRAMES] =
+        (HistoryFrame){.frame = ref, .pts = pts, .duration = duration, .size = size};
+    h->bytes += size;
+    h->count++;
+}
+
+// age 0 is the newest frame. Returns NULL past the oldest one.
+HistoryFrame *frame_history_get(FrameHistory *h, int age)
+{
+    if (age < 0 || age >= h->count)
+        return NULL;
+    return &h->frames[(h->start + h->count - 1 - age) % FRAME_HISTORY_MAX_FRAMES];
+}
+
+// Age of the newest frame at or before pts. Returns -1 when pts is before the
+// oldest frame or past the end of the newest one.
+int frame_history_find(FrameHistory *h, double pts)
+{
+    for (int age = 0; age < h->count; age++)
+    {
+        HistoryFrame *hf = frame_history_get(h, age);
+        if (hf->pts <= pts)
+            return age == 0 && pts >= hf->pts + hf->duration ? -1 : age;
+    }
+    return -1;
+}
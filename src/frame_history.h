@@ -0,0 +1,42 @@
+#ifndef FRAME_HISTORY_H
+#define FRAME_HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <libavutil/frame.h>
+
+// Upper bound on frames kept, whatever the byte budget allows.
+#define FRAME_HISTORY_MAX_FRAMES 1024
+
+struct HistoryFrame
+{
+    AVFrame *frame; // reference to the decoded picture, in the decoder's own format
+    double pts;     // seconds
+    double duration;
+    size_t size; // bytes the reference keeps alive
+};
+
+// Ring of the most recently displayed frames, newest last. Holding references to
+// the decoded pictures keeps them as compact as the decoder made them (YUV for
+// almost everything) and costs no copy. Only the render thread uses it.
+struct FrameHistory
+{
+    struct HistoryFrame frames[FRAME_HISTORY_MAX_FRAMES];
+    int start;
+    int count;
+    size_t bytes;
+    size_t budget; // 0 disables the history
+};
+
+typedef struct HistoryFrame HistoryFrame;
+typedef struct FrameHistory FrameHistory;
+
+void frame_history_init(FrameHistory *h, size_t budget);
+void frame_history_destroy(FrameHistory *h);
+void frame_history_clear(FrameHistory *h);
+void frame_history_set_budget(FrameHistory *h, size_t budget);
+void frame_history_push(FrameHistory *h, const AVFrame *frame, double pts, double duration);
+HistoryFrame *frame_history_get(FrameHistory *h, int age);
+int frame_history_find(FrameHistory *h, double pts);
+
+#endif // FRAME_HISTORY_H
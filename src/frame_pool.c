@@ -0,0 +1,184 @@
+#include "frame_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+
+FramePool *frame_pool_alloc(void)
+{
+    FramePool *pool = calloc(1, sizeof(*pool));
+    if (!pool)
+        return NULL;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pool->format = AV_PIX_FMT_NONE;
+    return pool;
+}
+
+static void frame_pool_free_blocks(FramePool *pool)
+{
+    while (pool->free_list)
+    {
+        struct PoolBlock *block = pool->free_list;
+        pool->free_list = block->next;
+        free(block);
+    }
+}
+
+static void frame_pool_destroy(FramePool *pool)
+{
+    frame_pool_free_blocks(pool);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+// Decoded frames may outlive the codec; the pool goes away with the last block.
+void frame_pool_release(FramePool *pool)
+{
+    if (!pool)
+        return;
+    pthread_mutex_lock(&pool->mutex);
+    pool->pending_release = true;
+    bool idle = pool->outstanding == 0;
+    pthread_mutex_unlock(&pool->mutex);
+    if (idle)
+        frame_pool_destroy(pool);
+}
+
+static void frame_pool_return(void *opaque, uint8_t *data)
+{
+    FramePool *pool = opaque;
+    struct PoolBlock *block = (struct PoolBlock *)(data - FRAME_POOL_ALIGN);
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->outstanding--;
+    bool destroy = pool->pending_release && pool->outstanding == 0;
+    // Blocks sized for a previous resolution are not reused.
+    if (!pool->pending_release && block->size == pool->block_size)
+    {
+        block->next = pool->free_list;
+        pool->free_list = block;
+        block = NULL;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    free(block);
+    if (destroy)
+        frame_pool_destroy(pool);
+}
+
+// Lays out all planes of one picture in a single block, padded the way the
+// codec asks for and with every linesize a multiple of FRAME_POOL_ALIGN.
+static int frame_pool_configure(FramePool *pool, AVCodecContext *ctx, AVFrame *frame)
+{
+    int width = frame->width;
+    int height = frame->height;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(ctx, &width, &height, linesize_align);
+
+    if (av_image_fill_linesizes(pool->linesize, frame->format, width) < 0)
+        return -1;
+    ptrdiff_t linesizes[4];
+    for (int i = 0; i < 4; i++)
+    {
+        pool->linesize[i] = FFALIGN(pool->linesize[i], FRAME_POOL_ALIGN);
+        linesizes[i] = pool->linesize[i];
+    }
+
+    size_t sizes[4];
+    if (av_image_fill_plane_sizes(sizes, frame->format, height, linesizes) < 0)
+        return -1;
+
+    size_t offset = 0;
+    pool->planes = 0;
+    for (int i = 0; i < 4 && sizes[i]; i++)
+    {
+        pool->plane_offset[i] = offset;
+        offset += FFALIGN(sizes[i], FRAME_POOL_ALIGN);
+        pool->planes++;
+    }
+    // Decoders may read a little past the end of the last row.
+    pool->block_size = FRAME_POOL_ALIGN + offset + 16 + FRAME_POOL_ALIGN - 1;
+    pool->width = frame->width;
+    pool->height = frame->height;
+    pool->format = frame->format;
+    frame_pool_free_blocks(pool);
+    return 0;
+}
+
+static int frame_pool_get_buffer(AVCodecContext *ctx, AVFrame *frame, int flags)
+{
+    FramePool *pool = ctx->opaque;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+
+    // Hardware frames and palettes need what only the default allocator provides.
+    if (!(ctx->codec->capabilities & AV_CODEC_CAP_DR1) || !desc ||
+        (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL)))
+        return avcodec_default_get_buffer2(ctx, frame, flags);
+
+    pthread_mutex_lock(&pool->mutex);
+    if ((frame->width != pool->width || frame->height != pool->height || frame->format != pool->format) &&
+        frame_pool_configure(pool, ctx, frame) < 0)
+    {
+        pthread_mutex_unlock(&pool->mutex);
+        return avcodec_default_get_buffer2(ctx, frame, flags);
+    }
+
+    struct PoolBlock *block = pool->free_list;
+    if (block)
+    {
+        pool->free_list = block->next;
+        pool->hits++;
+    }
+    else
+    {
+        if (posix_memalign((void **)&block, FRAME_POOL_ALIGN, pool->block_size) != 0)
+            block = NULL;
+        if (block)
+            block->size = pool->block_size;
+        pool->misses++;
+    }
+    if (!block)
+    {
+        pthread_mutex_unlock(&pool->mutex);
+        return AVERROR(ENOMEM);
+    }
+    if (++pool->outstanding > pool->peak)
+        pool->peak = pool->outstanding;
+    size_t data_size = pool->block_size - FRAME_POOL_ALIGN;
+    int planes = pool->planes;
+    int linesize[4];
+    size_t plane_offset[4];
+    memcpy(linesize, pool->linesize, sizeof(linesize));
+    memcpy(plane_offset, pool->plane_offset, sizeof(plane_offset));
+    pthread_mutex_unlock(&pool->mutex);
+
+    uint8_t *data = (uint8_t *)block + FRAME_POOL_ALIGN;
+    frame->buf[0] = av_buffer_create(data, data_size, frame_pool_return, pool, 0);
+    if (!frame->buf[0])
+    {
+        frame_pool_return(pool, data);
+        return AVERROR(ENOMEM);
+    }
+    for (int i = 0; i < planes; i++)
+    {
+        frame->data[i] = data + plane_offset[i];
+        frame->linesize[i] = linesize[i];
+    }
+    frame->extended_data = frame->data;
+    return 0;
+}
+
+void frame_pool_install(FramePool *pool, AVCodecContext *ctx)
+{
+    ctx->opaque = pool;
+    ctx->get_buffer2 = frame_pool_get_buffer;
+}
+
+void frame_pool_log_stats(FramePool *pool, const char *name)
+{
+    pthread_mutex_lock(&pool->mutex);
+    fprintf(stderr, "INFO: %s frame pool: %d hits, %d misses, %d peak buffers (%zu bytes each)\n",
+            name, pool->hits, pool->misses, pool->peak, pool->block_size);
+    pthread_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,46 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <libavcodec/avcodec.h>
+
+// Alignment of every plane and linesize handed to the decoder.
+#define FRAME_POOL_ALIGN 64
+
+// Header in front of each block's pixel data; FRAME_POOL_ALIGN bytes so the data stays aligned.
+struct PoolBlock
+{
+    struct PoolBlock *next;
+    size_t size;
+};
+
+// Picture buffers for a video decoder's get_buffer2. Each picture is one aligned
+// block holding all planes back to back, recycled when the last reference goes away.
+struct FramePool
+{
+    pthread_mutex_t mutex;
+    struct PoolBlock *free_list;
+    size_t block_size;
+    int width;
+    int height;
+    enum AVPixelFormat format;
+    int linesize[4];
+    size_t plane_offset[4];
+    int planes;
+
+    int hits;
+    int misses;
+    int outstanding;
+    int peak;
+    bool pending_release; // set once the owner is done; the last returned block frees the pool
+};
+
+typedef struct FramePool FramePool;
+
+FramePool *frame_pool_alloc(void);
+void frame_pool_release(FramePool *pool);
+void frame_pool_install(FramePool *pool, AVCodecContext *ctx);
+void frame_pool_log_stats(FramePool *pool, const char *name);
+
+#endif // FRAME_POOL_H
@@ -0,0 +1,112 @@
+#include "frame_queue.h"
+
+#include <stdio.h>
+#include <string.h>
+
+int frame_queue_init(FrameQueue *f, PacketQueue *pktq)
+{
+    memset(f, 0, sizeof(*f));
+    f->pktq = pktq;
+    for (int i = 0; i < FRAME_QUEUE_SIZE; i++)
+    {
+        f->queue[i].frame = av_frame_alloc();
+        if (!f->queue[i].frame)
+        {
+            fprintf(stderr, "ERROR: Could not allocate frame queue\n");
+            return -1;
+        }
+    }
+    pthread_mutex_init(&f->mutex, NULL);
+    pthread_cond_init(&f->cond, NULL);
+    return 0;
+}
+
+void frame_queue_destroy(FrameQueue *f)
+{
+    for (int i = 0; i < FRAME_QUEUE_SIZE; i++)
+    {
+        av_frame_free(&f->queue[i].frame);
+    }
+    pthread_mutex_destroy(&f->mutex);
+    pthread_cond_destroy(&f->cond);
+}
+
+void frame_queue_abort(FrameQueue *f)
+{
+    pthread_mutex_lock(&f->mutex);
+    f->abort_request = true;
+    pthread_cond_broadcast(&f->cond);
+    pthread_mutex_unlock(&f->mutex);
+}
+
+// Blocks until a slot is free. Returns NULL once the queue is aborted.
+VideoFrame *frame_queue_peek_writable(FrameQueue *f)
+{
+    pthread_mutex_lock(&f->mutex);
+    while (f->size >= FRAME_QUEUE_SIZE && !f->abort_request)
+        pthread_cond_wait(&f->cond, &f->mutex);
+    bool aborted = f->abort_request;
+    pthread_mutex_unlock(&f->mutex);
+
+    if (aborted)
+        return NULL;
+    return &f->queue[f->windex];
+}
+
+void frame_queue_push(FrameQueue *f)
+{
+    if (++f->windex == FRAME_QUEUE_SIZE)
+        f->windex = 0;
+    pthread_mutex_lock(&f->mutex);
+    f->size++;
+    pthread_cond_signal(&f->cond);
+    pthread_mutex_unlock(&f->mutex);
+}
+
+// Never blocks; returns NULL when nothing has been decoded yet.
+// Frames decoded before the last seek are released here, on the consumer side,
+// as soon as the seek has flushed the packet queue.
+VideoFrame *frame_queue_peek(FrameQueue *f)
+{
+    VideoFrame *vf = NULL;
+    int serial = packet_queue_serial(f->pktq);
+    pthread_mutex_lock(&f->mutex);
+    while (f->size > 0 && f->queue[f->rindex].serial != serial)
+    {
+        av_frame_unref(f->queue[f->rindex].frame);
+        if (++f->rindex == FRAME_QUEUE_SIZE)
+            f->rindex = 0;
+        f->size--;
+        pthread_cond_signal(&f->cond);
+    }
+    if (f->size > 0)
+        vf = &f->queue[f->rindex];
+    pthread_mutex_unlock(&f->mutex);
+    return vf;
+}
+
+VideoFrame *frame_queue_peek_next(FrameQueue *f)
+{
+    VideoFrame *vf = NULL;
+    int serial = packet_queue_serial(f->pktq);
+    pthread_mutex_lock(&f->mutex);
+    if (f->size > 1)
+    {
+        vf = &f->queue[(f->rindex + 1) % FRAME_QUEUE_SIZE];
+        if (vf->serial != serial)
+            vf = NULL;
+    }
+    pthread_mutex_unlock(&f->mutex);
+    return vf;
+}
+
+void frame_queue_next(FrameQueue *f)
+{
+    av_frame_unref(f->queue[f->rindex].frame);
+    pthread_mutex_lock(&f->mutex);
+    if (++f->rindex == FRAME_QUEUE_SIZE)
+        f->rindex = 0;
+    f->size--;
+    pthread_cond_signal(&f->cond);
+    pthread_mutex_unlock(&f->mutex);
+}
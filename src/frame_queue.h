@@ -0,0 +1,48 @@
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <libavutil/frame.h>
+
+#include "packet_queue.h"
+
+#define FRAME_QUEUE_SIZE 3
+
+struct VideoFrame
+{
+    AVFrame *frame;  // decoded picture, for formats the GPU converts itself
+    uint8_t *rgba;   // converted picture; memory is provided by the renderer
+    int width;       // size of the rgba picture, at most the source size
+    int height;
+    double pts;      // seconds
+    double duration; // seconds
+    int serial; // of the packet it was decoded from
+};
+
+struct FrameQueue
+{
+    struct VideoFrame queue[FRAME_QUEUE_SIZE];
+    int rindex;
+    int windex;
+    int size;
+    PacketQueue *pktq; // frames from a serial other than its current one are stale
+    bool abort_request;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+typedef struct VideoFrame VideoFrame;
+typedef struct FrameQueue FrameQueue;
+
+int frame_queue_init(FrameQueue *f, PacketQueue *pktq);
+void frame_queue_destroy(FrameQueue *f);
+void frame_queue_abort(FrameQueue *f);
+VideoFrame *frame_queue_peek_writable(FrameQueue *f);
+void frame_queue_push(FrameQueue *f);
+VideoFrame *frame_queue_peek(FrameQueue *f);
+VideoFrame *frame_queue_peek_next(FrameQueue *f);
+void frame_queue_next(FrameQueue *f);
+
+#endif // FRAME_QUEUE_H
@@ -0,0 +1,15 @@
+#ifndef GL_COMPAT_H
+#define GL_COMPAT_H
+
+// Direct OpenGL access for what rlgl does not expose (16-bit textures, pixel buffers).
+// raylib's desktop backend is OpenGL 3.3, so the core entry points are always there.
+#if defined(__APPLE__)
+#define GL_SILENCE_DEPRECATION
+#include <OpenGL/gl3.h>
+#else
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#endif
+
+#endif // GL_COMPAT_H
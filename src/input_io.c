@@ -0,0 +1,55 @@
+#include "input_io.h"
+
+#include <stdio.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+
+AVIOContext *input_io_alloc(void *opaque, int (*read_packet)(void *opaque, uint8_t *buf, int size),
+                            int64_t (*seek)(void *opaque, int64_t offset, int whence))
+{
+    AVIOContext *avio = NULL;
+    uint8_t *buffer = av_malloc(INPUT_IO_AVIO_BUFFER);
+    if (buffer)
+        avio = avio_alloc_context(buffer, INPUT_IO_AVIO_BUFFER, 0, opaque, read_packet, NULL, seek);
+    if (!avio)
+    {
+        fprintf(stderr, "ERROR: Could not allocate input I/O context\n");
+        av_free(buffer);
+    }
+    return avio;
+}
+
+// The buffer may have been replaced by libavformat, so it is freed through the context.
+void input_io_free(AVIOContext **avio)
+{
+    if (!*avio)
+        return;
+    av_freep(&(*avio)->buffer);
+    avio_context_free(avio);
+}
+
+// Where a seek callback is asked to go, given the current position: the file
+// size for AVSEEK_SIZE, which moves nothing, and an AVERROR for targets before
+// the start.
+int64_t input_io_seek_target(int64_t offset, int whence, int64_t pos, int64_t size)
+{
+    if (whence & AVSEEK_SIZE)
+        return size;
+
+    int64_t target;
+    switch (whence & ~AVSEEK_FORCE)
+    {
+    case SEEK_SET:
+        target = offset;
+        break;
+    case SEEK_CUR:
+        target = pos + offset;
+        break;
+    case SEEK_END:
+        target = size + offset;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    return target < 0 ? AVERROR(EINVAL) : target;
+}
@@ -0,0 +1,20 @@
+#ifndef INPUT_IO_H
+#define INPUT_IO_H
+
+#include <stdint.h>
+#include <libavformat/avio.h>
+
+#define INPUT_IO_AVIO_BUFFER (64 * 1024)
+
+// Shared by the input backends (ReadaheadIO, MmapIO, UringIO), which hand the
+// demuxer an AVIOContext over a local file. They only take regular files; for
+// anything else their open fails and the caller opens the file another way.
+// The backend owns the AVIOContext, and the demuxer using it must be closed
+// before the backend is.
+
+AVIOContext *input_io_alloc(void *opaque, int (*read_packet)(void *opaque, uint8_t *buf, int size),
+                            int64_t (*seek)(void *opaque, int64_t offset, int whence));
+void input_io_free(AVIOContext **avio);
+int64_t input_io_seek_target(int64_t offset, int whence, int64_t pos, int64_t size);
+
+#endif // INPUT_IO_H
@@ -0,0 +1,238 @@
+#include "keyframe_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static bool load_cache(KeyframeIndex *idx)
+{
+    int fd = open(idx->cache_path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(KeyframeIndexHeader))
+    {
+        close(fd);
+        return false;
+    }
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    const KeyframeIndexHeader *header = mapping;
+    size_t expected = sizeof(*header) + (size_t)header->count * sizeof(KeyframeEntry);
+    if (memcmp(header->magic, KEYFRAME_INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+        header->file_size != idx->file_size || header->file_mtime != idx->file_mtime ||
+        header->stream_index != idx->stream_index || header->count < 0 || expected != (size_t)st.st_size)
+    {
+        munmap(mapping, st.st_size);
+        return false;
+    }
+
+    idx->mapping = mapping;
+    idx->mapping_size = st.st_size;
+    idx->entries = (const KeyframeEntry *)(header + 1);
+    idx->count = header->count;
+    idx->ready = true;
+    return true;
+}
+
+// Written under a temporary name and renamed, so a reader never maps a partial file.
+static void save_cache(KeyframeIndex *idx)
+{
+    size_t tmp_len = strlen(idx->cache_path) + 5;
+    char *tmp_path = malloc(tmp_len);
+    if (!tmp_path)
+        return;
+    snprintf(tmp_path, tmp_len, "%s.tmp", idx->cache_path);
+
+    KeyframeIndexHeader header = {0};
+    memcpy(header.magic, KEYFRAME_INDEX_MAGIC, sizeof(header.magic));
+    header.file_size = idx->file_size;
+    header.file_mtime = idx->file_mtime;
+    header.stream_index = idx->stream_index;
+    header.count = idx->count;
+
+    FILE *file = fopen(tmp_path, "wb");
+    bool ok = file && fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(idx->built, sizeof(KeyframeEntry), idx->count, file) == (size_t)idx->count;
+    if (file && fclose(file) != 0)
+        ok = false;
+    if (ok && rename(tmp_path, idx->cache_path) == 0)
+    {
+        free(tmp_path);
+        return;
+    }
+    fprintf(stderr, "WARNING: Could not write keyframe index %s\n", idx->cache_path);
+    remove(tmp_path);
+    free(tmp_path);
+}
+
+static int add_entry(KeyframeIndex *idx, int64_t pts, int64_t pos)
+{
+    if (idx->count == idx->capacity)
+    {
+        int64_t capacity = idx->capacity ? idx->capacity * 2 : 1024;
+        KeyframeEntry *built = realloc(idx->built, capacity * sizeof(*built));
+        if (!built)
+            return -1;
+        idx->built = built;
+        idx->capacity = capacity;
+    }
+    idx->built[idx->count++] = (KeyframeEntry){.pts = pts, .pos = pos};
+    return 0;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    int64_t pa = ((const KeyframeEntry *)a)->pts;
+    int64_t pb = ((const KeyframeEntry *)b)->pts;
+    return (pa > pb) - (pa < pb);
+}
+
+static bool index_aborted(KeyframeIndex *idx)
+{
+    pthread_mutex_lock(&idx->mutex);
+    bool aborted = idx->abort_request;
+    pthread_mutex_unlock(&idx->mutex);
+    return aborted;
+}
+
+static int interrupt_callback(void *opaque)
+{
+    return index_aborted(opaque);
+}
+
+// Reads packet headers only; nothing is decoded.
+static void *index_thread(void *arg)
+{
+    KeyframeIndex *idx = arg;
+    AVFormatContext *format_ctx = avformat_alloc_context();
+    AVPacket *pkt = av_packet_alloc();
+    if (!format_ctx || !pkt)
+        goto end;
+    format_ctx->interrupt_callback = (AVIOInterruptCB){.callback = interrupt_callback, .opaque = idx};
+    if (avformat_open_input(&format_ctx, idx->filename, NULL, NULL) < 0)
+        goto end;
+    if (avformat_find_stream_info(format_ctx, NULL) < 0 || idx->stream_index >= (int)format_ctx->nb_streams)
+        goto end;
+    for (unsigned int i = 0; i < format_ctx->nb_streams; i++)
+    {
+        if ((int)i != idx->stream_index)
+            format_ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    int ret;
+    while ((ret = av_read_frame(format_ctx, pkt)) >= 0)
+    {
+        int64_t pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+        bool keyframe = pkt->stream_index == idx->stream_index && (pkt->flags & AV_PKT_FLAG_KEY);
+        if (keyframe && pts != AV_NOPTS_VALUE && pkt->pos >= 0 && add_entry(idx, pts, pkt->pos) < 0)
+            ret = AVERROR(ENOMEM);
+        av_packet_unref(pkt);
+        if (ret < 0)
+            break;
+    }
+    if (ret != AVERROR_EOF || index_aborted(idx))
+        goto end;
+
+    qsort(idx->built, idx->count, sizeof(KeyframeEntry), compare_entries);
+    save_cache(idx);
+
+    pthread_mutex_lock(&idx->mutex);
+    idx->entries = idx->built;
+    idx->ready = true;
+    pthread_mutex_unlock(&idx->mutex);
+
+end:
+    av_packet_free(&pkt);
+    avformat_close_input(&format_ctx);
+    return NULL;
+}
+
+// Maps the sidecar when it matches the file, otherwise starts the background pass.
+// On failure the index is left closed.
+int keyframe_index_open(KeyframeIndex *idx, const char *filename, int stream_index)
+{
+    memset(idx, 0, sizeof(*idx));
+    pthread_mutex_init(&idx->mutex, NULL);
+    idx->stream_index = stream_index;
+
+    struct stat st;
+    if (stat(filename, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        keyframe_index_close(idx);
+        return -1;
+    }
+    idx->file_size = st.st_size;
+    idx->file_mtime = st.st_mtime;
+
+    size_t len = strlen(filename);
+    idx->filename = strdup(filename);
+    idx->cache_path = malloc(len + sizeof(KEYFRAME_INDEX_SUFFIX));
+    if (!idx->filename || !idx->cache_path)
+    {
+        keyframe_index_close(idx);
+        return -1;
+    }
+    snprintf(idx->cache_path, len + sizeof(KEYFRAME_INDEX_SUFFIX), "%s%s", filename, KEYFRAME_INDEX_SUFFIX);
+
+    if (load_cache(idx))
+        return 0;
+    if (pthread_create(&idx->thread, NULL, index_thread, idx) != 0)
+    {
+        fprintf(stderr, "ERROR: Could not start keyframe index thread\n");
+        keyframe_index_close(idx);
+        return -1;
+    }
+    idx->thread_running = true;
+    return 0;
+}
+
+// Finds the last keyframe at or before pts. Returns false while the index is
+// still being built, or when pts precedes the first keyframe.
+bool keyframe_index_lookup(KeyframeIndex *idx, int64_t pts, int64_t *key_pts, int64_t *pos)
+{
+    pthread_mutex_lock(&idx->mutex);
+    bool ready = idx->ready;
+    pthread_mutex_unlock(&idx->mutex);
+    if (!ready || idx->count == 0 || pts < idx->entries[0].pts)
+        return false;
+
+    int64_t lo = 0, hi = idx->count - 1;
+    while (lo < hi)
+    {
+        int64_t mid = lo + (hi - lo + 1) / 2;
+        if (idx->entries[mid].pts <= pts)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    *key_pts = idx->entries[lo].pts;
+    *pos = idx->entries[lo].pos;
+    return true;
+}
+
+void keyframe_index_close(KeyframeIndex *idx)
+{
+    if (idx->thread_running)
+    {
+        pthread_mutex_lock(&idx->mutex);
+        idx->abort_request = true;
+        pthread_mutex_unlock(&idx->mutex);
+        pthread_join(idx->thread, NULL);
+    }
+    if (idx->mapping)
+        munmap(idx->mapping, idx->mapping_size);
+    free(idx->built);
+    free(idx->filename);
+    free(idx->cache_path);
+    pthread_mutex_destroy(&idx->mutex);
+    memset(idx, 0, sizeof(*idx));
+}
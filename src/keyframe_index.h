@@ -0,0 +1,63 @@
+#ifndef KEYFRAME_INDEX_H
+#define KEYFRAME_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <libavformat/avformat.h>
+
+// Sidecar written next to the media file, tagged with its size and mtime.
+#define KEYFRAME_INDEX_SUFFIX ".avpidx"
+#define KEYFRAME_INDEX_MAGIC "AVPKFI01"
+
+struct KeyframeEntry
+{
+    int64_t pts; // in the stream's time base
+    int64_t pos; // byte offset of the packet
+};
+
+// On-disk layout: this header, then count entries sorted by pts, host byte order.
+struct KeyframeIndexHeader
+{
+    char magic[8];
+    int64_t file_size;
+    int64_t file_mtime;
+    int32_t stream_index;
+    int32_t reserved;
+    int64_t count;
+};
+
+// Keyframe positions of one stream, either mapped from the sidecar or built by
+// a background pass over its own AVFormatContext. Lookups fail until it is ready.
+struct KeyframeIndex
+{
+    pthread_mutex_t mutex;
+    pthread_t thread;
+    bool thread_running;
+    bool abort_request;
+    bool ready;
+
+    const struct KeyframeEntry *entries; // sorted by pts once ready
+    int64_t count;
+    struct KeyframeEntry *built; // owned storage when built in this process
+    int64_t capacity;
+    void *mapping; // sidecar mapping when loaded from the cache
+    size_t mapping_size;
+
+    char *filename;
+    char *cache_path;
+    int stream_index;
+    int64_t file_size;
+    int64_t file_mtime;
+};
+
+typedef struct KeyframeEntry KeyframeEntry;
+typedef struct KeyframeIndexHeader KeyframeIndexHeader;
+typedef struct KeyframeIndex KeyframeIndex;
+
+int keyframe_index_open(KeyframeIndex *idx, const char *filename, int stream_index);
+bool keyframe_index_lookup(KeyframeIndex *idx, int64_t pts, int64_t *key_pts, int64_t *pos);
+void keyframe_index_close(KeyframeIndex *idx);
+
+#endif // KEYFRAME_INDEX_H
@@ -0,0 +1,94 @@
+#include "mmap_io.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+
+// madvise() wants a page-aligned start.
+static void advise_window(MmapIO *io, int64_t from)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    int64_t start = from & ~(int64_t)(page - 1);
+    int64_t end = FFMIN(from + MMAP_IO_WINDOW_BYTES, io->size);
+    if (end > start)
+        madvise(io->data + start, end - start, MADV_WILLNEED);
+    io->advised_end = end;
+}
+
+static int read_packet(void *opaque, uint8_t *buf, int size)
+{
+    MmapIO *io = opaque;
+    if (io->pos >= io->size)
+        return AVERROR_EOF;
+    int n = (int)FFMIN((int64_t)size, io->size - io->pos);
+    memcpy(buf, io->data + io->pos, n);
+    io->pos += n;
+    if (io->advised_end < io->size && io->advised_end - io->pos < MMAP_IO_WINDOW_BYTES / 2)
+        advise_window(io, io->pos);
+    return n;
+}
+
+static int64_t seek_packet(void *opaque, int64_t offset, int whence)
+{
+    MmapIO *io = opaque;
+    int64_t target = input_io_seek_target(offset, whence, io->pos, io->size);
+    if (target < 0 || (whence & AVSEEK_SIZE))
+        return target;
+    io->pos = target;
+    if (target < io->size)
+        advise_window(io, target);
+    return target;
+}
+
+// Files that do not fit the address space do not qualify either. The file
+// must not shrink while mapped.
+int mmap_io_open(MmapIO *io, const char *filename)
+{
+    memset(io, 0, sizeof(*io));
+    io->data = MAP_FAILED;
+    io->fd = open(filename, O_RDONLY | O_CLOEXEC);
+
+    struct stat st;
+    if (io->fd < 0 || fstat(io->fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+        (uint64_t)st.st_size > SIZE_MAX)
+    {
+        mmap_io_close(io);
+        return -1;
+    }
+    io->size = st.st_size;
+    io->data = mmap(NULL, io->size, PROT_READ, MAP_SHARED, io->fd, 0);
+    if (io->data == MAP_FAILED)
+    {
+        mmap_io_close(io);
+        return -1;
+    }
+    madvise(io->data, io->size, MADV_SEQUENTIAL);
+    advise_window(io, 0);
+
+    io->avio = input_io_alloc(io, read_packet, seek_packet);
+    if (!io->avio)
+    {
+        mmap_io_close(io);
+        return -1;
+    }
+    // Reads go straight into the caller's buffer instead of through the
+    // context's own, and seeks are cheap enough to always pass on.
+    io->avio->direct = 1;
+    return 0;
+}
+
+void mmap_io_close(MmapIO *io)
+{
+    input_io_free(&io->avio);
+    if (io->data != MAP_FAILED)
+        munmap(io->data, io->size);
+    if (io->fd >= 0)
+        close(io->fd);
+    memset(io, 0, sizeof(*io));
+    io->fd = -1;
+    io->data = MAP_FAILED;
+}
@@ -0,0 +1,30 @@
+#ifndef MMAP_IO_H
+#define MMAP_IO_H
+
+#include <stdint.h>
+#include "input_io.h"
+
+// Pages ahead of the read position the kernel is asked to bring in. The hint
+// is renewed once the position has used up half of it, and after every seek.
+#define MMAP_IO_WINDOW_BYTES (32 * 1024 * 1024)
+
+// An AVIOContext serving reads straight out of a read-only mapping of a local
+// file: no read syscalls, one copy from the mapping into the demuxer's packet
+// with no AVIOContext buffer in between, and a seek is pointer arithmetic. Reads fault pages in, so this suits local disks; on a network
+// filesystem a slow fault stalls the demuxer, which ReadaheadIO avoids.
+struct MmapIO
+{
+    AVIOContext *avio;
+    int fd;
+    uint8_t *data;
+    int64_t size;
+    int64_t pos;
+    int64_t advised_end; // end of the last WILLNEED window
+};
+
+typedef struct MmapIO MmapIO;
+
+int mmap_io_open(MmapIO *io, const char *filename);
+void mmap_io_close(MmapIO *io);
+
+#endif // MMAP_IO_H
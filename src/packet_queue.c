@@ -0,0 +1,165 @@
+#include "packet_queue.h"
+
+typedef struct
+{
+    AVPacket *pkt;
+    bool flush;
+    int serial;
+} PacketNode;
+
+int packet_queue_init(PacketQueue *q)
+{
+    memset(q, 0, sizeof(*q));
+    q->pkt_list = av_fifo_alloc2(64, sizeof(PacketNode), AV_FIFO_FLAG_AUTO_GROW);
+    if (!q->pkt_list)
+    {
+        fprintf(stderr, "ERROR: Could not allocate packet queue\n");
+        return -1;
+    }
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    return 0;
+}
+
+static void packet_queue_flush_locked(PacketQueue *q)
+{
+    PacketNode node;
+    while (av_fifo_read(q->pkt_list, &node, 1) >= 0)
+        av_packet_free(&node.pkt);
+    q->nb_packets = 0;
+    q->size = 0;
+    q->duration = 0;
+}
+
+void packet_queue_flush(PacketQueue *q)
+{
+    pthread_mutex_lock(&q->mutex);
+    packet_queue_flush_locked(q);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+void packet_queue_destroy(PacketQueue *q)
+{
+    if (!q->pkt_list)
+        return;
+    packet_queue_flush_locked(q);
+    av_fifo_freep2(&q->pkt_list);
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->cond);
+}
+
+void packet_queue_abort(PacketQueue *q)
+{
+    pthread_mutex_lock(&q->mutex);
+    q->abort_request = true;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+static int packet_queue_put_node(PacketQueue *q, PacketNode *node)
+{
+    pthread_mutex_lock(&q->mutex);
+    node->serial = q->serial;
+    if (q->abort_request || av_fifo_write(q->pkt_list, node, 1) < 0)
+    {
+        pthread_mutex_unlock(&q->mutex);
+        return -1;
+    }
+    if (node->pkt)
+    {
+        q->nb_packets++;
+        q->size += node->pkt->size + sizeof(*node);
+        q->duration += node->pkt->duration;
+    }
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+    return 0;
+}
+
+// Takes ownership of the packet's reference; pkt is left blank on return.
+int packet_queue_put(PacketQueue *q, AVPacket *pkt)
+{
+    PacketNode node = {.pkt = av_packet_alloc(), .flush = false};
+    if (!node.pkt)
+    {
+        av_packet_unref(pkt);
+        return -1;
+    }
+    av_packet_move_ref(node.pkt, pkt);
+
+    if (packet_queue_put_node(q, &node) < 0)
+    {
+        av_packet_free(&node.pkt);
+        return -1;
+    }
+    return 0;
+}
+
+// Drops everything queued and leaves a marker telling the consumer to flush its
+// codec. Returns the new serial, or -1 once the queue is aborted.
+int packet_queue_put_flush(PacketQueue *q)
+{
+    PacketNode node = {.pkt = NULL, .flush = true};
+    int ret;
+
+    pthread_mutex_lock(&q->mutex);
+    packet_queue_flush_locked(q);
+    node.serial = ++q->serial;
+    ret = node.serial;
+    if (q->abort_request || av_fifo_write(q->pkt_list, &node, 1) < 0)
+        ret = -1;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+    return ret;
+}
+
+// Consumers compare this with the serial of the packet they are working on to
+// notice a seek that happened since.
+int packet_queue_serial(PacketQueue *q)
+{
+    pthread_mutex_lock(&q->mutex);
+    int serial = q->serial;
+    pthread_mutex_unlock(&q->mutex);
+    return serial;
+}
+
+// serial receives the serial of the packet or flush marker returned.
+int packet_queue_get(PacketQueue *q, AVPacket *pkt, bool block, int *serial)
+{
+    PacketNode node;
+    int ret;
+
+    pthread_mutex_lock(&q->mutex);
+    for (;;)
+    {
+        if (q->abort_request)
+        {
+            ret = PACKET_QUEUE_ABORTED;
+            break;
+        }
+        if (av_fifo_read(q->pkt_list, &node, 1) >= 0)
+        {
+            *serial = node.serial;
+            if (node.flush)
+            {
+                ret = PACKET_QUEUE_FLUSH;
+                break;
+            }
+            q->nb_packets--;
+            q->size -= node.pkt->size + sizeof(node);
+            q->duration -= node.pkt->duration;
+            av_packet_move_ref(pkt, node.pkt);
+            av_packet_free(&node.pkt);
+            ret = PACKET_QUEUE_PACKET;
+            break;
+        }
+        if (!block)
+        {
+            ret = PACKET_QUEUE_EMPTY;
+            break;
+        }
+        pthread_cond_wait(&q->cond, &q->mutex);
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return ret;
+}
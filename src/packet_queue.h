@@ -0,0 +1,37 @@
+#ifndef PACKET_QUEUE_H
+#define PACKET_QUEUE_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/fifo.h>
+
+#define PACKET_QUEUE_ABORTED -1
+#define PACKET_QUEUE_EMPTY 0
+#define PACKET_QUEUE_PACKET 1
+#define PACKET_QUEUE_FLUSH 2
+
+struct PacketQueue
+{
+    AVFifo *pkt_list;
+    int nb_packets;
+    int size;         // bytes held, including node overhead
+    int64_t duration; // sum of packet durations, in stream time base
+    int serial;       // bumped by packet_queue_put_flush(); every packet carries the one it was queued under
+    bool abort_request;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+typedef struct PacketQueue PacketQueue;
+
+int packet_queue_init(PacketQueue *q);
+void packet_queue_destroy(PacketQueue *q);
+void packet_queue_abort(PacketQueue *q);
+void packet_queue_flush(PacketQueue *q);
+int packet_queue_put(PacketQueue *q, AVPacket *pkt);
+int packet_queue_put_flush(PacketQueue *q);
+int packet_queue_get(PacketQueue *q, AVPacket *pkt, bool block, int *serial);
+int packet_queue_serial(PacketQueue *q);
+
+#endif // PACKET_QUEUE_H
@@ -2,6 +2,8 @@
 #include "raylib.h"
 #include "raymath.h"
 
+#include <stdlib.h>
+
 #define FONT_SIZE 36
 #define ICON_SIZE 32 / 1.25
 #define BUTTON_RADIUS ICON_SIZE * 1.5f
@@ -43,18 +45,7 @@ char *get_file_title(DecoderState *ds)
 
 void audio_callback(void *buffer, unsigned int frames)
 {
-    if (av_audio_fifo_size(ds.fifo) >= (int)frames)
-    {
-        int ret = av_audio_fifo_read(ds.fifo, &buffer, frames);
-        if (ret < (int)frames)
-        {
-            memset((float *)buffer + ret * 2, 0, (frames - ret) * sizeof(float) * 2);
-        }
-    }
-    else
-    {
-        memset(buffer, 0, frames * sizeof(float) * 2);
-    }
+    decoder_read_audio(buffer, (int)frames);
 }
 
 int player_init(char *filename)
@@ -86,12 +77,23 @@ int player_init(char *filename)
                         ds.audio_codec_ctx->ch_layout.nb_channels);
     SetAudioStreamCallback(ps.raylib_audio_stream, audio_callback);
 
-    Image frame_image = {.data = ds.rgba_frame_buffer,
-                         .width = ds.video_codec_ctx->width,
-                         .height = ds.video_codec_ctx->height,
-                         .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
-                         .mipmaps = 1};
-    ps.texture = LoadTextureFromImage(frame_image);
+    if (renderer_init(&ps.renderer, ds.frame_format, ds.video_codec_ctx->width,
+                      ds.video_codec_ctx->height) < 0)
+        ds.frame_format = ps.renderer.format;
+    if (renderer_attach_queue(&ps.renderer, &ds.pictq) < 0)
+        return -1;
+
+    ps.thumbnail_slot = -1;
+    ps.has_thumbnails = thumbnailer_open(&ps.thumbnails, filename, ds.video_stream_idx, ds.video_codec_ctx->width,
+                                         ds.video_codec_ctx->height,
+                                         (double)ds.format_ctx->duration / AV_TIME_BASE, true) == 0;
+    if (ps.has_thumbnails)
+    {
+        Image image = GenImageColor(ps.thumbnails.width, ps.thumbnails.height, BLACK);
+        ps.thumbnail_texture = LoadTextureFromImage(image);
+        UnloadImage(image);
+        ps.thumbnail_pixels = malloc((size_t)ps.thumbnails.width * ps.thumbnails.height * 4);
+    }
     PlayAudioStream(ps.raylib_audio_stream);
     ps.volume = 100;
     SetAudioStreamVolume(ps.raylib_audio_stream, ps.volume / 100);
@@ -99,6 +101,16 @@ int player_init(char *filename)
     shaderArray.capacity = 4; // Initial capacity
     shaderArray.shaders = malloc(shaderArray.capacity * sizeof(Shader));
     shaderArray.shaderCount = 0;
+
+    const char *scale_threads = getenv("AVP_SCALE_THREADS");
+    if (scale_threads)
+        decoder_set_scale_threads(atoi(scale_threads));
+    const char *history_mb = getenv("AVP_HISTORY_MB");
+    if (history_mb)
+        decoder_set_history_budget(atoi(history_mb));
+
+    if (decoder_start() < 0)
+        return -1;
     return 0;
 }
 
@@ -150,6 +162,52 @@ MouseButtonPressedTimes DetectMouseButtonDoublePressed(int button)
     return BUTTON_CLICK_NONE;
 }
 
+// The audio stream and the master clock are paused together so video resumes in sync.
+// Either way reverse playback ends.
+static void set_playing(bool playing)
+{
+    decoder_set_reverse(0);
+    decoder_set_trick_speed(0);
+    isPlaying = playing;
+    if (playing)
+        ResumeAudioStream(ps.raylib_audio_stream);
+    else
+        PauseAudioStream(ps.raylib_audio_stream);
+    decoder_set_paused(!playing);
+    last_hover_time = GetTime();
+}
+
+// Preview above the seekbar at the hovered position. Shows nothing until the
+// thumbnail thread has produced that slot; it never waits for it.
+static void draw_hover_thumbnail(Rectangle seekBar, double total_runtime, float alpha)
+{
+    float mouse_x = GetMousePosition().x;
+    double hover_time = (mouse_x - seekBar.x) / seekBar.width * total_runtime;
+    int slot = thumbnailer_slot(&ps.thumbnails, hover_time);
+    if (slot != ps.thumbnail_slot && ps.thumbnail_pixels &&
+        thumbnailer_get(&ps.thumbnails, slot, ps.thumbnail_pixels))
+    {
+        UpdateTexture(ps.thumbnail_texture, ps.thumbnail_pixels);
+        ps.thumbnail_slot = slot;
+    }
+    if (slot != ps.thumbnail_slot)
+        return;
+
+    Texture texture = ps.thumbnail_texture;
+    float x = Clamp(mouse_x - texture.width / 2.0f, seekBar.x, seekBar.x + seekBar.width - texture.width);
+    Rectangle frame = {x, seekBar.y - texture.height - 16, (float)texture.width, (float)texture.height};
+    DrawRectangleRec((Rectangle){frame.x - 2, frame.y - 2, frame.width + 4, frame.height + 4}, Fade(RAYWHITE, alpha));
+    DrawTexturePro(texture, (Rectangle){0, 0, (float)texture.width, (float)texture.height}, frame,
+                   Vector2Zero(), 0, Fade(WHITE, alpha));
+
+    char hover_text[16];
+    sprintf(hover_text, "%02d:%02d", (int)(hover_time / 60), (int)hover_time % 60);
+    Vector2 hoverTextSize = MeasureTextEx(google, hover_text, FONT_SIZE / 2, 0);
+    DrawTextEx(google, hover_text,
+               (Vector2){frame.x + (frame.width - hoverTextSize.x) / 2, frame.y + frame.height - hoverTextSize.y - 4},
+               FONT_SIZE / 2, 0, Fade(RAYWHITE, alpha));
+}
+
 void player_update(void)
 {
     int screenWidth = GetDisplayWidth();
@@ -194,24 +252,79 @@ void player_update(void)
         dest_rect.y = -(dest_rect.height - screenHeight) / 2;
     }
 
+    decoder_set_output_size((int)dest_rect.width, (int)dest_rect.height);
+
     if (IsKeyPressed(KEY_SPACE))
     {
-        isPlaying = !isPlaying;
-        last_hover_time = GetTime();
+        set_playing(!isPlaying);
     }
-    if (isPlaying)
+    // J plays backwards and L forwards, faster with every press; K pauses. Past
+    // the fastest reverse speed, and past normal speed forwards, they switch to
+    // keyframe-only trick play.
+    if (IsKeyPressed(KEY_J))
     {
-        decoder_decode_frame(ps.texture, &frame_time);
-        isPlaying ? PlayAudioStream(ps.raylib_audio_stream)
-                  : PauseAudioStream(ps.raylib_audio_stream);
-        decoder_fill_audio_queue(ps.texture, &frame_time);
+        if (ds.trick_speed < 0)
+        {
+            decoder_set_trick_speed(FFMAX(ds.trick_speed * 2, -TRICK_MAX_SPEED));
+        }
+        else if (ds.reverse_speed >= REVERSE_MAX_SPEED)
+        {
+            decoder_set_reverse(0);
+            decoder_set_trick_speed(-TRICK_MIN_SPEED);
+        }
+        else
+        {
+            double speed = ds.reverse_speed > 0 ? ds.reverse_speed * 2 : 1.0;
+            if (isPlaying)
+                set_playing(false);
+            decoder_set_reverse(speed);
+        }
+    }
+    if (IsKeyPressed(KEY_L))
+    {
+        if (ds.trick_speed > 0)
+            decoder_set_trick_speed(FFMIN(ds.trick_speed * 2, TRICK_MAX_SPEED));
+        else if (isPlaying && ds.reverse_speed == 0 && ds.trick_speed == 0)
+            decoder_set_trick_speed(TRICK_MIN_SPEED);
+        else
+            set_playing(true);
+    }
+    // [ and ] step through the playback speeds, \ goes back to normal speed.
+    if (IsKeyPressed(KEY_LEFT_BRACKET) || IsKeyPressed(KEY_RIGHT_BRACKET))
+    {
+        static const double speeds[] = {0.5, 0.75, 1.0, 1.25, 1.5, 2.0, 3.0, 4.0};
+        int count = sizeof(speeds) / sizeof(speeds[0]);
+        int i = 0;
+        while (i < count - 1 && speeds[i] < ds.playback_speed)
+            i++;
+        if (IsKeyPressed(KEY_RIGHT_BRACKET) && speeds[i] <= ds.playback_speed && i < count - 1)
+            i++;
+        else if (IsKeyPressed(KEY_LEFT_BRACKET) && i > 0)
+            i--;
+        decoder_set_speed(speeds[i]);
+        TraceLog(LOG_INFO, "Playback speed: %.2fx", ds.playback_speed);
+    }
+    if (IsKeyPressed(KEY_BACKSLASH))
+        decoder_set_speed(1.0);
+    if (IsKeyPressed(KEY_K))
+        set_playing(false);
+
+    if (ds.reverse_speed > 0)
+    {
+        // Stays paused on the first frame once it gets there.
+        if (decoder_present_reverse(&ps.renderer, &frame_time) < 0)
+            decoder_set_reverse(0);
+    }
+    else if (isPlaying || ds.trick_speed != 0)
+    {
+        decoder_present_frame(&ps.renderer, &frame_time);
     }
     Rectangle setting = {0, (float)screenHeight - settingHeight,
                          (float)screenWidth, settingHeight};
     char elapsed_text[16];
     char total_text[16];
     sprintf(elapsed_text, "%02d:%02d", (int)(frame_time / 60),
-            (int)(frame_time % 60));
+            (int)frame_time % 60);
     sprintf(total_text, "%02d:%02d", (int)(total_runtime / 60),
             (int)(total_runtime) % 60);
 
@@ -253,7 +366,7 @@ void player_update(void)
     }
     if (IsKeyPressed(KEY_P) && !isPlaying)
     {
-        if (ExportImage(LoadImageFromTexture(ps.texture), "frame.png"))
+        if (ExportImage(LoadImageFromTexture(ps.renderer.texture), "frame.png"))
         {
             TraceLog(LOG_INFO, "Saved frame in  an image");
         }
@@ -265,21 +378,24 @@ void player_update(void)
         if (seek_time < 0)
             seek_time = 0;
         printf("Seeking backward to %.2f seconds\n", seek_time);
-        int64_t seek_target = (int64_t)(seek_time / av_q2d(ds.video_stream->time_base));
-        if (avformat_seek_file(
-                ds.format_ctx,
-                ds.video_stream_idx,
-                INT64_MIN,
-                seek_target,
-                INT64_MAX,
-                AVSEEK_FLAG_BACKWARD) < 0)
+        // The history shows the target at once; while playing, the decoders still
+        // have to restart from there.
+        bool from_history = decoder_seek_history(&ps.renderer, seek_time, &frame_time);
+        if (!from_history || isPlaying)
         {
-            printf("Seek error!\n");
+            int64_t seek_target = (int64_t)(seek_time / av_q2d(ds.video_stream->time_base));
+            decoder_seek(seek_target, AVSEEK_FLAG_BACKWARD | DECODER_SEEK_EXACT);
+            frame_time = seek_time;
         }
+    }
 
-        avcodec_flush_buffers(ds.video_codec_ctx);
-        av_audio_fifo_reset(ds.fifo);
-        frame_time = seek_time;
+    // Frame stepping pauses playback, forwards or backwards, and walks the
+    // history of shown frames.
+    if (IsKeyPressed(KEY_COMMA) || IsKeyPressed(KEY_PERIOD))
+    {
+        if (isPlaying || ds.reverse_speed > 0)
+            set_playing(false);
+        decoder_step_frame(&ps.renderer, IsKeyPressed(KEY_PERIOD) ? 1 : -1, &frame_time);
     }
 
     if (IsKeyPressed(KEY_RIGHT))
@@ -292,12 +408,7 @@ void player_update(void)
 
         printf("Seeking forward to %.2f seconds\n", seek_time);
         int64_t seek_target = (int64_t)(seek_time / av_q2d(ds.video_stream->time_base));
-        if (avformat_seek_file(ds.format_ctx, ds.video_stream_idx, INT64_MIN, seek_target, INT64_MAX, 0) < 0)
-        {
-            printf("Seek error!\n");
-        }
-        avcodec_flush_buffers(ds.video_codec_ctx);
-        av_audio_fifo_reset(ds.fifo);
+        decoder_seek(seek_target, DECODER_SEEK_EXACT);
         frame_time = seek_time;
     }
 
@@ -313,24 +424,23 @@ void player_update(void)
             if (seekTime > total_runtime)
                 seekTime = total_runtime;
 
-            int flags = 0;
+            int flags = DECODER_SEEK_EXACT;
             if (seekTime < frame_time)
-                flags = AVSEEK_FLAG_BACKWARD;
+                flags |= AVSEEK_FLAG_BACKWARD;
 
             printf("Seeking to %.2f seconds\n", seekTime);
-            int64_t seek_target = (int64_t)(seekTime / av_q2d(ds.video_stream->time_base));
-            if (avformat_seek_file(ds.format_ctx, ds.video_stream_idx, INT64_MIN, seek_target, INT64_MAX, flags) < 0)
+            bool from_history = (flags & AVSEEK_FLAG_BACKWARD) &&
+                                decoder_seek_history(&ps.renderer, seekTime, &frame_time);
+            if (!from_history || isPlaying)
             {
-                printf("Seek error!\n");
+                int64_t seek_target = (int64_t)(seekTime / av_q2d(ds.video_stream->time_base));
+                decoder_seek(seek_target, flags);
+                frame_time = seekTime;
             }
-            avcodec_flush_buffers(ds.video_codec_ctx);
-            av_audio_fifo_reset(ds.fifo);
-            frame_time = seekTime;
         }
         else
         {
-            isPlaying = !isPlaying;
-            last_hover_time = GetTime();
+            set_playing(!isPlaying);
         }
     }
 
@@ -386,9 +496,9 @@ void player_update(void)
     }
 
     Rectangle destRect = {0, 0, screenWidth, screenHeight};
-    DrawTexturePro(ps.texture,
-                   (Rectangle){0, 0, (float)ds.video_codec_ctx->width,
-                               (float)ds.video_codec_ctx->height},
+    DrawTexturePro(ps.renderer.texture,
+                   (Rectangle){0, 0, (float)ps.renderer.texture.width,
+                               (float)ps.renderer.texture.height},
                    dest_rect, Vector2Zero(), 0, WHITE);
 
     for (int i = 0; i < shaderArray.shaderCount; i++)
@@ -409,13 +519,32 @@ void player_update(void)
         DrawCircleSector((Vector2){seekBar.x, seekBar.y + seekBar.height / 2}, seekBar.height / 2, 90, 270, 50, Fade(DARKBLUE, alpha));
         DrawCircleSector((Vector2){seekBar.x + seekBar.width, seekBar.y + seekBar.height / 2}, seekBar.height / 2, 270, 360 + 90, 50, Fade(GetColor(0xB7B7B7FF), alpha));
 
+        if (ps.has_thumbnails && CheckCollisionPointRec(GetMousePosition(), seekBar))
+            draw_hover_thumbnail(seekBar, total_runtime, alpha);
+
         DrawTextEx(google, elapsed_text, elapsedTimePos, FONT_SIZE / 1.5, 0, Fade(RAYWHITE, alpha));
         DrawTextEx(google, total_text, totalTimePos, FONT_SIZE / 1.5, 0, Fade(RAYWHITE, alpha));
+        if (ds.playback_speed != 1.0 || ds.trick_speed != 0)
+        {
+            char speed_text[16];
+            if (ds.trick_speed != 0)
+                sprintf(speed_text, "%dx", ds.trick_speed);
+            else
+                sprintf(speed_text, "%gx", ds.playback_speed);
+            Vector2 speedTextSize = MeasureTextEx(google, speed_text, FONT_SIZE / 1.5, 0);
+            DrawTextEx(google, speed_text, (Vector2){seekBar.x + (seekBar.width - speedTextSize.x) / 2, elapsedTimePos.y},
+                       FONT_SIZE / 1.5, 0, Fade(RAYWHITE, alpha));
+        }
         DrawTextEx(google, ps.file_title, videoTitlePos, FONT_SIZE, 0, Fade(RAYWHITE, alpha));
 
         // DrawCircleV((Vector2){screenWidth / 2, screenHeight / 2}, 48, Fade(RAYWHITE, alpha));
 
-        DrawTexturePro(isPlaying ? pauseTexture : playTexture,
+        Texture2D stateTexture = isPlaying ? pauseTexture : playTexture;
+        if (ds.trick_speed > 0)
+            stateTexture = ffTexture;
+        else if (ds.trick_speed < 0 || ds.reverse_speed > 0)
+            stateTexture = bbTexture;
+        DrawTexturePro(stateTexture,
                        (Rectangle){0, 0, playTexture.width, playTexture.height},
                        (Rectangle){screenWidth / 2 - playTexture.width / 2, screenHeight / 2 - playTexture.height / 2, playTexture.width, playTexture.height},
                        (Vector2){0, 0}, 0.0f,
@@ -433,7 +562,6 @@ void player_close(void)
     }
     free(shaderArray.shaders);
 
-    UnloadTexture(ps.texture);
     UnloadAudioStream(ps.raylib_audio_stream);
     CloseAudioDevice();
 
@@ -443,15 +571,16 @@ void player_close(void)
     UnloadTexture(ffTexture);
     UnloadTexture(bbTexture);
 
-    av_packet_free(&ds.packet);
-    av_frame_free(&ds.frame);
-    sws_freeContext(ds.sws_ctx);
-    free(ds.rgba_frame_buffer);
-    av_audio_fifo_free(ds.fifo);
-    swr_free(&ds.swr_ctx);
-    avcodec_free_context(&ds.video_codec_ctx);
-    avcodec_free_context(&ds.audio_codec_ctx);
-    avformat_close_input(&ds.format_ctx);
+    if (ps.has_thumbnails)
+    {
+        thumbnailer_close(&ps.thumbnails);
+        UnloadTexture(ps.thumbnail_texture);
+        free(ps.thumbnail_pixels);
+    }
+
+    // Stop the decoder threads before releasing the memory they write into.
+    decoder_close();
+    renderer_close(&ps.renderer);
 
     CloseWindow();
 }
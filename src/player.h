@@ -2,13 +2,19 @@
 #define PLAYER_H
 
 #include "decoder.h"
+#include "thumbnailer.h"
 #include "raylib.h"
 
 struct PlayerState {
-  Texture texture;
+  VideoRenderer renderer;
   AudioStream raylib_audio_stream;
   char *file_title;
   float volume;
+  Thumbnailer thumbnails;
+  bool has_thumbnails;
+  Texture thumbnail_texture;
+  uint8_t *thumbnail_pixels;
+  int thumbnail_slot; // slot currently in thumbnail_texture, -1 for none
 };
 typedef enum {
   SINGLE_CLICK,
@@ -19,7 +25,7 @@ typedef enum {
 typedef struct PlayerState PlayerState;
 
 extern PlayerState ps;
-extern int64_t frame_time;
+extern double frame_time;
 
 void audio_callback(void *buffer, unsigned int frames);
 int player_init(char *filename);
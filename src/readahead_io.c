@@ -0,0 +1,276 @@
+#include "readahead_io.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+// The consumption rate is measured over windows of this length.
+#define RATE_WINDOW_SECONDS 2.0
+
+// Page cache hints; other systems simply go without them.
+#if defined(__linux__)
+#define ADVISE(fd, offset, len, advice) posix_fadvise(fd, offset, len, POSIX_FADV_##advice)
+#else
+#define ADVISE(fd, offset, len, advice) ((void)0)
+#endif
+
+// Called with the mutex held after every read by the demuxer. A window in
+// which nothing was read (paused) says nothing about the stream and is skipped.
+static void update_depth_locked(ReadaheadIO *io, int64_t now)
+{
+    double elapsed = (now - io->rate_since) / 1000000.0;
+    if (elapsed < RATE_WINDOW_SECONDS)
+        return;
+    if (io->rate_bytes > 0)
+    {
+        double rate = io->rate_bytes / elapsed;
+        io->measured_rate = io->measured_rate > 0 ? (io->measured_rate + rate) / 2 : rate;
+    }
+    io->rate_bytes = 0;
+    io->rate_since = now;
+
+    double rate = FFMAX(io->measured_rate, io->bitrate_hint);
+    io->depth = av_clip64((int64_t)(rate * READAHEAD_SECONDS), READAHEAD_MIN_BYTES, READAHEAD_MAX_BYTES);
+}
+
+// Ring size for a depth: the data ahead of pos, READAHEAD_KEEP_BYTES behind
+// it and room for the chunk being read; never more than the whole file.
+static size_t ring_capacity(const ReadaheadIO *io, size_t depth)
+{
+    return (size_t)FFMIN((int64_t)(depth + READAHEAD_KEEP_BYTES), io->file_size) + READAHEAD_CHUNK_BYTES;
+}
+
+// How far the thread reads ahead of pos: the depth, unless the ring could not
+// be grown to it.
+static int64_t ahead_limit(const ReadaheadIO *io)
+{
+    if (io->ring_full_size)
+        return FFMIN((int64_t)io->depth, (int64_t)(io->capacity - READAHEAD_CHUNK_BYTES));
+    return io->depth;
+}
+
+// Called by the thread with the mutex held, so no read is in flight, and
+// once the demuxer is not copying out of the ring. [start, end) moves to the
+// same file offsets in the larger ring.
+static void grow_ring_locked(ReadaheadIO *io, size_t capacity)
+{
+    uint8_t *ring = av_malloc(capacity);
+    if (!ring)
+    {
+        fprintf(stderr, "ERROR: Could not grow read-ahead buffer to %zu bytes\n", capacity);
+        io->ring_full_size = true;
+        return;
+    }
+    for (int64_t from = io->start; from < io->end;)
+    {
+        size_t old_offset = from % io->capacity;
+        size_t new_offset = from % capacity;
+        size_t len = FFMIN3((size_t)(io->end - from), io->capacity - old_offset, capacity - new_offset);
+        memcpy(ring + new_offset, io->ring + old_offset, len);
+        from += len;
+    }
+    av_free(io->ring);
+    io->ring = ring;
+    io->capacity = capacity;
+}
+
+static void *readahead_thread(void *arg)
+{
+    ReadaheadIO *io = arg;
+
+    pthread_mutex_lock(&io->mutex);
+    for (;;)
+    {
+        while (!io->abort_request &&
+               (io->error || io->end >= io->file_size || io->end - io->pos >= ahead_limit(io)))
+            pthread_cond_wait(&io->cond, &io->mutex);
+        if (io->abort_request)
+            break;
+
+        size_t capacity = ring_capacity(io, io->depth);
+        if (capacity > io->capacity && !io->ring_full_size)
+        {
+            while (!io->abort_request && io->copying)
+                pthread_cond_wait(&io->cond, &io->mutex);
+            if (io->abort_request)
+                break;
+            grow_ring_locked(io, capacity);
+            continue;
+        }
+
+        // One contiguous chunk at end. The thread stays a chunk short of
+        // filling the ring ahead of pos, so the oldest data it drops for the
+        // chunk is never data still ahead of pos.
+        size_t offset = io->end % io->capacity;
+        size_t len = FFMIN(READAHEAD_CHUNK_BYTES, io->capacity - offset);
+        len = FFMIN(len, (size_t)(io->file_size - io->end));
+        int64_t dropped_from = io->start;
+        if (io->end + (int64_t)len - io->start > (int64_t)io->capacity)
+            io->start = io->end + len - io->capacity;
+        int64_t dropped = io->start - dropped_from;
+        int64_t read_pos = io->end;
+        int serial = io->serial;
+        pthread_mutex_unlock(&io->mutex);
+
+        if (dropped > 0)
+            ADVISE(io->fd, dropped_from, dropped, DONTNEED);
+        ADVISE(io->fd, read_pos + len, 2 * READAHEAD_CHUNK_BYTES, WILLNEED);
+        ssize_t n;
+        do
+            n = pread(io->fd, io->ring + offset, len, read_pos);
+        while (n < 0 && errno == EINTR);
+        int error = n < 0 ? AVERROR(errno) : AVERROR_EOF;
+
+        pthread_mutex_lock(&io->mutex);
+        if (serial != io->serial)
+            continue;
+        if (n > 0)
+            io->end += n;
+        else
+            io->error = error;
+        pthread_cond_broadcast(&io->cond);
+    }
+    pthread_mutex_unlock(&io->mutex);
+    return NULL;
+}
+
+// Copies out of the ring, waiting for the thread only when it is empty at pos.
+static int read_packet(void *opaque, uint8_t *buf, int size)
+{
+    ReadaheadIO *io = opaque;
+
+    pthread_mutex_lock(&io->mutex);
+    while (!io->abort_request && io->pos >= io->end && !io->error && io->pos < io->file_size)
+        pthread_cond_wait(&io->cond, &io->mutex);
+    if (io->pos >= io->end)
+    {
+        int ret = io->pos >= io->file_size ? AVERROR_EOF : io->error ? io->error : AVERROR_EXIT;
+        pthread_mutex_unlock(&io->mutex);
+        return ret;
+    }
+    size_t offset = io->pos % io->capacity;
+    int n = (int)FFMIN3((int64_t)size, io->end - io->pos, (int64_t)(io->capacity - offset));
+    io->copying = true;
+    pthread_mutex_unlock(&io->mutex);
+
+    // [pos, end) is never written by the thread, and the ring is not replaced
+    // while copying is set, so this needs no lock.
+    memcpy(buf, io->ring + offset, n);
+
+    pthread_mutex_lock(&io->mutex);
+    io->copying = false;
+    io->pos += n;
+    io->rate_bytes += n;
+    update_depth_locked(io, av_gettime_relative());
+    pthread_cond_broadcast(&io->cond);
+    pthread_mutex_unlock(&io->mutex);
+    return n;
+}
+
+// Inside the ring this only moves pos. Anywhere else the ring starts over at
+// the target and the read in flight, if any, is dropped when it completes.
+static int64_t seek_packet(void *opaque, int64_t offset, int whence)
+{
+    ReadaheadIO *io = opaque;
+    pthread_mutex_lock(&io->mutex);
+    int64_t target = input_io_seek_target(offset, whence, io->pos, io->file_size);
+    if (target < 0 || (whence & AVSEEK_SIZE))
+    {
+        pthread_mutex_unlock(&io->mutex);
+        return target;
+    }
+    if (target >= io->start && target <= io->end)
+    {
+        io->pos = target;
+    }
+    else
+    {
+        io->start = io->end = io->pos = target;
+        io->error = 0;
+        io->serial++;
+    }
+    pthread_cond_broadcast(&io->cond);
+    pthread_mutex_unlock(&io->mutex);
+    return target;
+}
+
+int readahead_io_open(ReadaheadIO *io, const char *filename)
+{
+    memset(io, 0, sizeof(*io));
+    pthread_mutex_init(&io->mutex, NULL);
+    pthread_cond_init(&io->cond, NULL);
+    io->fd = open(filename, O_RDONLY | O_CLOEXEC);
+
+    struct stat st;
+    if (io->fd < 0 || fstat(io->fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        readahead_io_close(io);
+        return -1;
+    }
+    io->file_size = st.st_size;
+    io->depth = READAHEAD_MIN_BYTES;
+    io->capacity = ring_capacity(io, io->depth);
+    io->rate_since = av_gettime_relative();
+
+    io->ring = av_malloc(io->capacity);
+    if (!io->ring)
+    {
+        fprintf(stderr, "ERROR: Could not allocate read-ahead buffer\n");
+        readahead_io_close(io);
+        return -1;
+    }
+    io->avio = input_io_alloc(io, read_packet, seek_packet);
+    if (!io->avio)
+    {
+        readahead_io_close(io);
+        return -1;
+    }
+    ADVISE(io->fd, 0, 0, SEQUENTIAL);
+
+    if (pthread_create(&io->thread, NULL, readahead_thread, io) != 0)
+    {
+        fprintf(stderr, "ERROR: Could not start read-ahead thread\n");
+        readahead_io_close(io);
+        return -1;
+    }
+    io->thread_running = true;
+    return 0;
+}
+
+// The container's bitrate in bits per second, so the depth fits the stream
+// before the first measurement is in.
+void readahead_io_set_bitrate(ReadaheadIO *io, int64_t bit_rate)
+{
+    pthread_mutex_lock(&io->mutex);
+    io->bitrate_hint = bit_rate > 0 ? bit_rate / 8.0 : 0;
+    io->depth = av_clip64((int64_t)(io->bitrate_hint * READAHEAD_SECONDS), READAHEAD_MIN_BYTES, READAHEAD_MAX_BYTES);
+    pthread_cond_broadcast(&io->cond);
+    pthread_mutex_unlock(&io->mutex);
+}
+
+void readahead_io_close(ReadaheadIO *io)
+{
+    if (io->thread_running)
+    {
+        pthread_mutex_lock(&io->mutex);
+        io->abort_request = true;
+        pthread_cond_broadcast(&io->cond);
+        pthread_mutex_unlock(&io->mutex);
+        pthread_join(io->thread, NULL);
+    }
+    input_io_free(&io->avio);
+    av_freep(&io->ring);
+    if (io->fd >= 0)
+        close(io->fd);
+    pthread_mutex_destroy(&io->mutex);
+    pthread_cond_destroy(&io->cond);
+    memset(io, 0, sizeof(*io));
+    io->fd = -1;
+}
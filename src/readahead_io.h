@@ -0,0 +1,62 @@
+#ifndef READAHEAD_IO_H
+#define READAHEAD_IO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "input_io.h"
+
+// Read-ahead depth: this many seconds at the measured bitrate, within these bounds.
+#define READAHEAD_SECONDS 10
+#define READAHEAD_MIN_BYTES (4 * 1024 * 1024)
+#define READAHEAD_MAX_BYTES (192 * 1024 * 1024)
+// Largest single read the thread issues.
+#define READAHEAD_CHUNK_BYTES (1024 * 1024)
+// Already consumed data the ring keeps behind the read position, for short
+// backward seeks. The ring is sized for the depth plus this, and grows with
+// the depth.
+#define READAHEAD_KEEP_BYTES (16 * 1024 * 1024)
+
+// An AVIOContext over a local file, fed by a thread that keeps a ring buffer
+// filled ahead of the demuxer, so a slow read on a network filesystem is
+// absorbed by the buffer instead of stalling playback. The ring keeps already
+// consumed data too, as far as space allows: a seek inside [start, end) only
+// moves pos.
+struct ReadaheadIO
+{
+    AVIOContext *avio;
+    int fd;
+    int64_t file_size;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool thread_running;
+    bool abort_request;
+
+    uint8_t *ring;
+    size_t capacity;
+    bool ring_full_size; // growing failed; depth is held to what fits
+    bool copying;        // the demuxer is copying out of the ring without the mutex
+    int64_t start; // file offsets held in the ring: [start, end)
+    int64_t end;
+    int64_t pos;   // next byte the demuxer reads
+    int serial;    // bumped by seeks outside the ring; a read in flight for an older one is dropped
+    int error;     // from the last failed read at end, 0 otherwise
+
+    // Depth adapts to how fast the demuxer consumes, measured over a few seconds.
+    size_t depth;
+    double bitrate_hint; // bytes per second, from the container
+    double measured_rate;
+    int64_t rate_bytes;
+    int64_t rate_since; // av_gettime_relative() when rate_bytes started counting
+};
+
+typedef struct ReadaheadIO ReadaheadIO;
+
+int readahead_io_open(ReadaheadIO *io, const char *filename);
+void readahead_io_set_bitrate(ReadaheadIO *io, int64_t bit_rate);
+void readahead_io_close(ReadaheadIO *io);
+
+#endif // READAHEAD_IO_H
@@ -0,0 +1,508 @@
+#include "renderer.h"
+#include "gl_compat.h"
+#include "rlgl.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavutil/pixdesc.h>
+
+// fragTexCoord addresses the Y plane; chromaScale maps it onto the chroma plane(s),
+// whose textures are as wide as their linesize rather than the picture.
+// Samples are rescaled to code values of the source bit depth, then range and
+// matrix are applied: range = (yOffset, yScale, cOffset, cScale),
+// matrix = (R from V, G from U, G from V, B from U).
+static const char *yuv_fragment_shader =
+    "#version 330\n"
+    "in vec2 fragTexCoord;\n"
+    "out vec4 finalColor;\n"
+    "uniform sampler2D texture0;\n"
+    "uniform sampler2D texU;\n"
+    "uniform sampler2D texV;\n"
+    "uniform vec2 chromaScale;\n"
+    "uniform int interleaved;\n"
+    "uniform float sampleScale;\n"
+    "uniform vec4 range;\n"
+    "uniform vec4 matrix;\n"
+    "void main()\n"
+    "{\n"
+    "    vec2 c = fragTexCoord * chromaScale;\n"
+    "    vec2 uv = interleaved != 0 ? texture(texU, c).rg : vec2(texture(texU, c).r, texture(texV, c).r);\n"
+    "    float y = (texture(texture0, fragTexCoord).r * sampleScale - range.x) * range.y;\n"
+    "    uv = (uv * sampleScale - range.z) * range.w;\n"
+    "    vec3 rgb = vec3(y + matrix.x * uv.y, y + matrix.y * uv.x + matrix.z * uv.y, y + matrix.w * uv.x);\n"
+    "    finalColor = vec4(clamp(rgb, 0.0, 1.0), 1.0);\n"
+    "}\n";
+
+typedef struct
+{
+    GLenum internal_format;
+    GLenum format;
+    GLenum type;
+    int texel_size;
+} PlaneFormat;
+
+static const PlaneFormat plane_r8 = {GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1};
+static const PlaneFormat plane_rg8 = {GL_RG8, GL_RG, GL_UNSIGNED_BYTE, 2};
+static const PlaneFormat plane_r16 = {GL_R16, GL_RED, GL_UNSIGNED_SHORT, 2};
+static const PlaneFormat plane_rg16 = {GL_RG16, GL_RG, GL_UNSIGNED_SHORT, 4};
+
+// Packed RGB sources are uploaded as decoded; the channel order is handled by
+// the upload format and type, and the padding byte of the X formats by an RGB
+// internal format, so sampling and read-back both see plain RGBA. The 8_8_8_8
+// types address the bytes of ARGB/ABGR as one native-endian word.
+typedef struct
+{
+    enum AVPixelFormat pix_fmt;
+    PlaneFormat plane;
+} PackedFormat;
+
+static const PackedFormat packed_formats[] = {
+    {AV_PIX_FMT_RGBA, {GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4}},
+    {AV_PIX_FMT_BGRA, {GL_RGBA8, GL_BGRA, GL_UNSIGNED_BYTE, 4}},
+    {AV_PIX_FMT_ARGB, {GL_RGBA8, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8, 4}},
+    {AV_PIX_FMT_ABGR, {GL_RGBA8, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, 4}},
+    {AV_PIX_FMT_RGB0, {GL_RGB8, GL_RGBA, GL_UNSIGNED_BYTE, 4}},
+    {AV_PIX_FMT_BGR0, {GL_RGB8, GL_BGRA, GL_UNSIGNED_BYTE, 4}},
+    {AV_PIX_FMT_0RGB, {GL_RGB8, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8, 4}},
+    {AV_PIX_FMT_0BGR, {GL_RGB8, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, 4}},
+    {AV_PIX_FMT_RGB24, {GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE, 3}},
+    {AV_PIX_FMT_BGR24, {GL_RGB8, GL_BGR, GL_UNSIGNED_BYTE, 3}},
+};
+
+static const PlaneFormat *packed_plane_format(enum AVPixelFormat pix_fmt)
+{
+    for (size_t i = 0; i < sizeof(packed_formats) / sizeof(packed_formats[0]); i++)
+    {
+        if (packed_formats[i].pix_fmt == pix_fmt)
+            return &packed_formats[i].plane;
+    }
+    return NULL;
+}
+
+static int plane_formats(FrameFormat format, const PlaneFormat *planes[3])
+{
+    switch (format)
+    {
+    case FRAME_FORMAT_YUV420P:
+        planes[0] = planes[1] = planes[2] = &plane_r8;
+        return 3;
+    case FRAME_FORMAT_NV12:
+        planes[0] = &plane_r8;
+        planes[1] = &plane_rg8;
+        return 2;
+    case FRAME_FORMAT_P010:
+        planes[0] = &plane_r16;
+        planes[1] = &plane_rg16;
+        return 2;
+    case FRAME_FORMAT_YUV420P16:
+        planes[0] = planes[1] = planes[2] = &plane_r16;
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+// rlgl only knows half-float 16-bit textures, so plane textures are created
+// directly and wrapped in a Texture for DrawTexturePro() and the shader binding.
+static Texture load_plane_texture(const PlaneFormat *pf, int width, int height)
+{
+    Texture texture = {.width = width, .height = height, .mipmaps = 1, .format = PIXELFORMAT_UNCOMPRESSED_GRAYSCALE};
+    glGenTextures(1, &texture.id);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture.id);
+    glTexImage2D(GL_TEXTURE_2D, 0, pf->internal_format, width, height, 0, pf->format, pf->type, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
+
+// data is a client pointer, or an offset when a pixel buffer is bound.
+static void update_plane_texture(Texture texture, const PlaneFormat *pf, const void *data)
+{
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture.id);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture.width, texture.height, pf->format, pf->type, data);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+static int renderer_init_yuv(VideoRenderer *r)
+{
+    r->yuv_shader = LoadShaderFromMemory(NULL, yuv_fragment_shader);
+    if (!IsShaderValid(r->yuv_shader) || r->yuv_shader.id == rlGetShaderIdDefault())
+    {
+        TraceLog(LOG_WARNING, "YUV shader unavailable, converting frames on the CPU");
+        return -1;
+    }
+    r->u_loc = GetShaderLocation(r->yuv_shader, "texU");
+    r->v_loc = GetShaderLocation(r->yuv_shader, "texV");
+    r->chroma_scale_loc = GetShaderLocation(r->yuv_shader, "chromaScale");
+    r->interleaved_loc = GetShaderLocation(r->yuv_shader, "interleaved");
+    r->sample_scale_loc = GetShaderLocation(r->yuv_shader, "sampleScale");
+    r->range_loc = GetShaderLocation(r->yuv_shader, "range");
+    r->matrix_loc = GetShaderLocation(r->yuv_shader, "matrix");
+
+    const PlaneFormat *planes[3];
+    r->plane_count = plane_formats(r->format, planes);
+    glGenBuffers(PBO_RING_SIZE, r->upload_pbo);
+    r->target = LoadRenderTexture(r->width, r->height);
+    r->texture = r->target.texture;
+    return 0;
+}
+
+int renderer_init(VideoRenderer *r, FrameFormat format, int width, int height)
+{
+    r->format = format;
+    r->width = width;
+    r->height = height;
+
+    bool yuv = r->format != FRAME_FORMAT_RGBA && r->format != FRAME_FORMAT_PACKED_RGB;
+    if (yuv && renderer_init_yuv(r) < 0)
+        r->format = FRAME_FORMAT_RGBA;
+
+    r->packed_pix_fmt = AV_PIX_FMT_NONE;
+    if (r->format == FRAME_FORMAT_RGBA || r->format == FRAME_FORMAT_PACKED_RGB)
+    {
+        Image image = GenImageColor(width, height, BLACK);
+        r->texture = LoadTextureFromImage(image);
+        UnloadImage(image);
+    }
+    return r->format == format ? 0 : -1;
+}
+
+// Orphans the buffer's storage and maps the fresh one, so neither call waits for a
+// transfer still reading the previous contents.
+static uint8_t *map_pixel_buffer(unsigned int pbo, size_t size)
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    uint8_t *ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return ptr;
+}
+
+// Gives each queue slot the memory the video thread converts into. Must run
+// before the decoder starts and only matters for the RGBA path.
+int renderer_attach_queue(VideoRenderer *r, FrameQueue *queue)
+{
+    r->queue = queue;
+    if (r->format != FRAME_FORMAT_RGBA)
+        return 0;
+
+    size_t size = (size_t)r->width * r->height * 4;
+    for (int i = 0; i < FRAME_QUEUE_SIZE; i++)
+    {
+        glGenBuffers(1, &r->slot_pbo[i]);
+        queue->queue[i].rgba = map_pixel_buffer(r->slot_pbo[i], size);
+        if (queue->queue[i].rgba)
+            continue;
+
+        TraceLog(LOG_WARNING, "Could not map pixel buffer, uploading from client memory");
+        glDeleteBuffers(1, &r->slot_pbo[i]);
+        r->slot_pbo[i] = 0;
+        r->slot_memory[i] = calloc(1, size);
+        if (!r->slot_memory[i])
+        {
+            fprintf(stderr, "ERROR: Could not allocate frame buffer\n");
+            return -1;
+        }
+        queue->queue[i].rgba = r->slot_memory[i];
+    }
+    return 0;
+}
+
+// Slots are sized for the source picture; frames scaled down for a smaller
+// window fill only the front of them, and the texture follows the frame size.
+static void resize_rgba_texture(VideoRenderer *r, int width, int height)
+{
+    if (r->texture.width == width && r->texture.height == height)
+        return;
+    UnloadTexture(r->texture);
+    Image image = GenImageColor(width, height, BLACK);
+    r->texture = LoadTextureFromImage(image);
+    UnloadImage(image);
+}
+
+static void renderer_upload_rgba(VideoRenderer *r, VideoFrame *vf)
+{
+    int slot = (int)(vf - r->queue->queue);
+    unsigned int pbo = r->slot_pbo[slot];
+    resize_rgba_texture(r, vf->width, vf->height);
+    if (!pbo)
+    {
+        UpdateTexture(r->texture, vf->rgba);
+        return;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, r->texture.id);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, vf->width, vf->height, GL_RGBA, GL_UNSIGNED_BYTE, (void *)0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    // Remap before the slot goes back to the decoder.
+    vf->rgba = map_pixel_buffer(pbo, (size_t)r->width * r->height * 4);
+    if (!vf->rgba)
+    {
+        TraceLog(LOG_WARNING, "Could not remap pixel buffer, uploading from client memory");
+        glDeleteBuffers(1, &r->slot_pbo[slot]);
+        r->slot_pbo[slot] = 0;
+        r->slot_memory[slot] = calloc(1, (size_t)r->width * r->height * 4);
+        vf->rgba = r->slot_memory[slot];
+    }
+}
+
+// Plane textures are sized by linesize so they can be filled from decoder memory as-is.
+static void ensure_plane_textures(VideoRenderer *r, const AVFrame *frame, const PlaneFormat *planes[3])
+{
+    int chroma_height = (r->height + 1) / 2;
+    for (int i = 0; i < r->plane_count; i++)
+    {
+        if (r->plane_linesize[i] == frame->linesize[i])
+            continue;
+        if (r->planes[i].id)
+            UnloadTexture(r->planes[i]);
+        r->planes[i] = load_plane_texture(planes[i], frame->linesize[i] / planes[i]->texel_size,
+                                          i == 0 ? r->height : chroma_height);
+        r->plane_linesize[i] = frame->linesize[i];
+    }
+}
+
+// Kr/Kb for the frame's matrix; untagged content is assumed BT.709 from 720p up.
+static void yuv_matrix(const AVFrame *frame, float matrix[4])
+{
+    float kr = 0.299f, kb = 0.114f;
+    if (frame->colorspace == AVCOL_SPC_BT709 ||
+        (frame->colorspace == AVCOL_SPC_UNSPECIFIED && frame->height >= 720))
+    {
+        kr = 0.2126f;
+        kb = 0.0722f;
+    }
+    else if (frame->colorspace == AVCOL_SPC_BT2020_NCL)
+    {
+        kr = 0.2627f;
+        kb = 0.0593f;
+    }
+    float kg = 1.0f - kr - kb;
+    matrix[0] = 2.0f * (1.0f - kr);
+    matrix[1] = -2.0f * kb * (1.0f - kb) / kg;
+    matrix[2] = -2.0f * kr * (1.0f - kr) / kg;
+    matrix[3] = 2.0f * (1.0f - kb);
+}
+
+// Range offsets and gains in code values normalised to the source bit depth.
+static void yuv_range(const AVFrame *frame, int depth, float range[4])
+{
+    float max = (float)((1 << depth) - 1);
+    float step = (float)(1 << (depth - 8));
+    bool full = frame->color_range == AVCOL_RANGE_JPEG || frame->format == AV_PIX_FMT_YUVJ420P;
+
+    range[0] = full ? 0.0f : 16.0f * step / max;
+    range[1] = full ? 1.0f : max / (219.0f * step);
+    range[2] = 128.0f * step / max;
+    range[3] = full ? 1.0f : max / (224.0f * step);
+}
+
+static void renderer_upload_yuv(VideoRenderer *r, const AVFrame *frame)
+{
+    const PlaneFormat *planes[3];
+    plane_formats(r->format, planes);
+    ensure_plane_textures(r, frame, planes);
+
+    // Pictures from the frame pool keep all planes in one buffer, in order; those
+    // are staged with a single copy at their original offsets.
+    bool contiguous = !frame->buf[1];
+    size_t offsets[3], size = 0;
+    for (int i = 0; i < r->plane_count && contiguous; i++)
+    {
+        if (frame->data[i] < frame->data[0] + size)
+        {
+            contiguous = false;
+            break;
+        }
+        offsets[i] = frame->data[i] - frame->data[0];
+        size = offsets[i] + (size_t)frame->linesize[i] * r->planes[i].height;
+    }
+    if (!contiguous)
+    {
+        size = 0;
+        for (int i = 0; i < r->plane_count; i++)
+        {
+            offsets[i] = size;
+            size += (size_t)frame->linesize[i] * r->planes[i].height;
+        }
+    }
+
+    unsigned int pbo = r->upload_pbo[r->upload_index];
+    r->upload_index = (r->upload_index + 1) % PBO_RING_SIZE;
+    uint8_t *staging = pbo ? map_pixel_buffer(pbo, size) : NULL;
+    if (staging)
+    {
+        if (contiguous)
+            memcpy(staging, frame->data[0], size);
+        else
+            for (int i = 0; i < r->plane_count; i++)
+                memcpy(staging + offsets[i], frame->data[i], (size_t)frame->linesize[i] * r->planes[i].height);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        for (int i = 0; i < r->plane_count; i++)
+            update_plane_texture(r->planes[i], planes[i], (const void *)offsets[i]);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    else
+    {
+        for (int i = 0; i < r->plane_count; i++)
+            update_plane_texture(r->planes[i], planes[i], frame->data[i]);
+    }
+
+    // 16-bit textures normalise by 65535; rescale so the maximum code value of
+    // the real depth (stored in the low bits, or shifted up for P010) reads as 1.0.
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    int depth = desc->comp[0].depth;
+    float sample_scale = 1.0f;
+    if (planes[0]->type == GL_UNSIGNED_SHORT)
+        sample_scale = 65535.0f / (float)(((1 << depth) - 1) << desc->comp[0].shift);
+
+    Vector2 chroma_scale = {
+        (float)r->planes[0].width / (2.0f * r->planes[1].width),
+        (float)r->height / (2.0f * r->planes[1].height),
+    };
+    int interleaved = r->plane_count == 2;
+    float range[4], matrix[4];
+    yuv_range(frame, depth, range);
+    yuv_matrix(frame, matrix);
+
+    // Drawn flipped so target ends up in the same orientation as a loaded texture.
+    BeginTextureMode(r->target);
+    BeginShaderMode(r->yuv_shader);
+    SetShaderValueTexture(r->yuv_shader, r->u_loc, r->planes[1]);
+    if (!interleaved)
+        SetShaderValueTexture(r->yuv_shader, r->v_loc, r->planes[2]);
+    SetShaderValue(r->yuv_shader, r->chroma_scale_loc, &chroma_scale, SHADER_UNIFORM_VEC2);
+    SetShaderValue(r->yuv_shader, r->interleaved_loc, &interleaved, SHADER_UNIFORM_INT);
+    SetShaderValue(r->yuv_shader, r->sample_scale_loc, &sample_scale, SHADER_UNIFORM_FLOAT);
+    SetShaderValue(r->yuv_shader, r->range_loc, range, SHADER_UNIFORM_VEC4);
+    SetShaderValue(r->yuv_shader, r->matrix_loc, matrix, SHADER_UNIFORM_VEC4);
+    DrawTexturePro(r->planes[0],
+                   (Rectangle){0, 0, (float)r->width, -(float)r->height},
+                   (Rectangle){0, 0, (float)r->width, (float)r->height},
+                   (Vector2){0, 0}, 0, WHITE);
+    EndShaderMode();
+    EndTextureMode();
+}
+
+// Points GL at rows stride bytes apart. Returns false when no combination of
+// row length and alignment describes the stride.
+static bool set_unpack_stride(int stride, int width, int texel_size)
+{
+    if (stride % texel_size == 0)
+    {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, stride / texel_size);
+        return true;
+    }
+    for (int alignment = 8; alignment > 1; alignment /= 2)
+    {
+        if ((width * texel_size + alignment - 1) / alignment * alignment == stride)
+        {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void renderer_upload_packed(VideoRenderer *r, const AVFrame *frame)
+{
+    const PlaneFormat *pf = packed_plane_format(frame->format);
+    if (!pf)
+        return;
+    if (r->packed_pix_fmt != frame->format)
+    {
+        UnloadTexture(r->texture);
+        r->texture = load_plane_texture(pf, r->width, r->height);
+        r->texture.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+        r->packed_pix_fmt = frame->format;
+    }
+
+    GLint alignment, row_length;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glGetIntegerv(GL_UNPACK_ROW_LENGTH, &row_length);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, r->texture.id);
+    if (frame->linesize[0] > 0 && set_unpack_stride(frame->linesize[0], r->width, pf->texel_size))
+    {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, r->width, r->height, pf->format, pf->type, frame->data[0]);
+    }
+    else
+    {
+        // Bottom-up pictures and odd strides go a row at a time, still without a copy.
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        for (int y = 0; y < r->height; y++)
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, r->width, 1, pf->format, pf->type,
+                            frame->data[0] + (ptrdiff_t)y * frame->linesize[0]);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, row_length);
+}
+
+// Runs on the render thread with the frame the presenter picked.
+void renderer_upload(VideoRenderer *r, VideoFrame *vf)
+{
+    if (r->format == FRAME_FORMAT_RGBA)
+        renderer_upload_rgba(r, vf);
+    else if (r->format == FRAME_FORMAT_PACKED_RGB)
+        renderer_upload_packed(r, vf->frame);
+    else
+        renderer_upload_yuv(r, vf->frame);
+}
+
+// Uploads a decoded picture that is not in the frame queue, such as one from the
+// frame history. Not for the RGBA path, whose pictures are converted on the CPU.
+void renderer_upload_frame(VideoRenderer *r, const AVFrame *frame)
+{
+    if (r->format == FRAME_FORMAT_PACKED_RGB)
+        renderer_upload_packed(r, frame);
+    else if (r->format != FRAME_FORMAT_RGBA)
+        renderer_upload_yuv(r, frame);
+}
+
+// RGBA path: uploads a picture converted outside the frame queue.
+void renderer_upload_pixels(VideoRenderer *r, const uint8_t *rgba, int width, int height)
+{
+    resize_rgba_texture(r, width, height);
+    UpdateTexture(r->texture, rgba);
+}
+
+// The decoder must be stopped first: deleting a mapped buffer unmaps it.
+void renderer_close(VideoRenderer *r)
+{
+    for (int i = 0; i < FRAME_QUEUE_SIZE; i++)
+    {
+        if (r->slot_pbo[i])
+            glDeleteBuffers(1, &r->slot_pbo[i]);
+        free(r->slot_memory[i]);
+    }
+    if (r->format == FRAME_FORMAT_RGBA || r->format == FRAME_FORMAT_PACKED_RGB)
+    {
+        UnloadTexture(r->texture);
+        return;
+    }
+    glDeleteBuffers(PBO_RING_SIZE, r->upload_pbo);
+    for (int i = 0; i < r->plane_count; i++)
+    {
+        if (r->planes[i].id)
+            UnloadTexture(r->planes[i]);
+    }
+    UnloadRenderTexture(r->target);
+    UnloadShader(r->yuv_shader);
+}
@@ -0,0 +1,61 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "raylib.h"
+#include "frame_queue.h"
+
+// How decoded pictures reach the screen, chosen by decoder_init() from the codec's pixel format.
+#define PBO_RING_SIZE 3
+
+typedef enum
+{
+    FRAME_FORMAT_RGBA,      // converted on the CPU by sws_scale()
+    FRAME_FORMAT_YUV420P,   // 8-bit Y, U, V planes, converted in a shader
+    FRAME_FORMAT_NV12,      // 8-bit Y plane and interleaved UV plane
+    FRAME_FORMAT_P010,      // 16-bit Y plane and interleaved UV plane (P010, P016)
+    FRAME_FORMAT_YUV420P16, // 16-bit little-endian Y, U, V planes (yuv420p10/12/16)
+    FRAME_FORMAT_PACKED_RGB, // 8-bit packed RGB in any channel order, uploaded as decoded
+} FrameFormat;
+
+struct VideoRenderer
+{
+    FrameFormat format;
+    int width;
+    int height;
+    Texture texture; // RGBA picture drawn by the player
+    enum AVPixelFormat packed_pix_fmt; // packed RGB path: source format texture was created for
+
+    // YUV paths: one texture per decoder plane, converted into target by yuv_shader
+    RenderTexture2D target;
+    int plane_count;
+    Texture planes[3];
+    int plane_linesize[3];
+    Shader yuv_shader;
+    int u_loc;
+    int v_loc;
+    int chroma_scale_loc;
+    int interleaved_loc;
+    int sample_scale_loc;
+    int range_loc;
+    int matrix_loc;
+
+    // Pixel buffer objects. RGBA queue slots stay mapped so the decoder converts
+    // straight into them; YUV planes are staged through a ring. Either way the
+    // texture update is sourced from a buffer and does not wait on the copy.
+    FrameQueue *queue;
+    unsigned int slot_pbo[FRAME_QUEUE_SIZE];
+    uint8_t *slot_memory[FRAME_QUEUE_SIZE]; // used when a slot cannot be mapped
+    unsigned int upload_pbo[PBO_RING_SIZE];
+    int upload_index;
+};
+
+typedef struct VideoRenderer VideoRenderer;
+
+int renderer_init(VideoRenderer *r, FrameFormat format, int width, int height);
+int renderer_attach_queue(VideoRenderer *r, FrameQueue *queue);
+void renderer_upload(VideoRenderer *r, VideoFrame *vf);
+void renderer_upload_frame(VideoRenderer *r, const AVFrame *frame);
+void renderer_upload_pixels(VideoRenderer *r, const uint8_t *rgba, int width, int height);
+void renderer_close(VideoRenderer *r);
+
+#endif // RENDERER_H
@@ -0,0 +1,342 @@
+#include "reverse_decoder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+typedef struct
+{
+    AVFormatContext *format_ctx;
+    AVCodecContext *codec_ctx;
+    AVPacket *packet;
+    AVFrame *frame;
+} GopDecoder;
+
+static size_t frame_size(const AVFrame *frame)
+{
+    size_t size = 0;
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++)
+        size += frame->buf[i]->size;
+    return size;
+}
+
+static void gop_clear(ReverseGop *gop)
+{
+    for (int i = 0; i < gop->count; i++)
+        av_frame_free(&gop->frames[i]);
+    gop->count = 0;
+    gop->bytes = 0;
+}
+
+static void gop_drop_first(ReverseGop *gop)
+{
+    gop->bytes -= frame_size(gop->frames[0]);
+    av_frame_free(&gop->frames[0]);
+    gop->count--;
+    memmove(gop->frames, gop->frames + 1, gop->count * sizeof(gop->frames[0]));
+    memmove(gop->pts, gop->pts + 1, gop->count * sizeof(gop->pts[0]));
+}
+
+// Decoders output in presentation order, so frames are appended. When the GOP
+// outgrows its budget the earliest frames go; the next GOP then ends where
+// this one starts and decodes them again.
+static void gop_append(ReverseGop *gop, AVFrame *frame, double pts)
+{
+    size_t budget = (size_t)REVERSE_GOP_BUDGET_MB * 1024 * 1024;
+    size_t size = frame_size(frame);
+    while (gop->count > 0 && (gop->count == REVERSE_GOP_MAX_FRAMES || gop->bytes + size > budget))
+        gop_drop_first(gop);
+
+    AVFrame *ref = av_frame_alloc();
+    if (!ref)
+    {
+        av_frame_unref(frame);
+        return;
+    }
+    av_frame_move_ref(ref, frame);
+    gop->frames[gop->count] = ref;
+    gop->pts[gop->count] = pts;
+    gop->bytes += size;
+    gop->count++;
+}
+
+static bool job_cancelled(ReverseDecoder *rd, int serial)
+{
+    pthread_mutex_lock(&rd->mutex);
+    bool cancelled = rd->abort_request || rd->serial != serial;
+    pthread_mutex_unlock(&rd->mutex);
+    return cancelled;
+}
+
+static int interrupt_callback(void *opaque)
+{
+    ReverseDecoder *rd = opaque;
+    pthread_mutex_lock(&rd->mutex);
+    bool aborted = rd->abort_request;
+    pthread_mutex_unlock(&rd->mutex);
+    return aborted;
+}
+
+static void close_decoder(GopDecoder *d)
+{
+    av_frame_free(&d->frame);
+    av_packet_free(&d->packet);
+    avcodec_free_context(&d->codec_ctx);
+    avformat_close_input(&d->format_ctx);
+}
+
+// Full quality and all the threads the codec wants: a GOP has to decode in
+// less time than it takes to show.
+static int open_decoder(ReverseDecoder *rd, GopDecoder *d)
+{
+    d->format_ctx = avformat_alloc_context();
+    d->packet = av_packet_alloc();
+    d->frame = av_frame_alloc();
+    if (!d->format_ctx || !d->packet || !d->frame)
+        return -1;
+    d->format_ctx->interrupt_callback = (AVIOInterruptCB){.callback = interrupt_callback, .opaque = rd};
+    if (avformat_open_input(&d->format_ctx, rd->filename, NULL, NULL) < 0 ||
+        avformat_find_stream_info(d->format_ctx, NULL) < 0 || rd->stream_index >= (int)d->format_ctx->nb_streams)
+        return -1;
+    for (unsigned int i = 0; i < d->format_ctx->nb_streams; i++)
+    {
+        if ((int)i != rd->stream_index)
+            d->format_ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    AVStream *stream = d->format_ctx->streams[rd->stream_index];
+    const AVCodec *codec = avcodec_find_decoder(stream->codecpar->codec_id);
+    if (!codec)
+        return -1;
+    d->codec_ctx = avcodec_alloc_context3(codec);
+    if (!d->codec_ctx || avcodec_parameters_to_context(d->codec_ctx, stream->codecpar) < 0)
+        return -1;
+    d->codec_ctx->thread_count = 0;
+    return avcodec_open2(d->codec_ctx, codec, NULL);
+}
+
+// Fills gop with the frames that start before end, decoding forward from the
+// last keyframe before it. Returns -1 when cancelled or when there is no such
+// keyframe.
+static int decode_gop(ReverseDecoder *rd, GopDecoder *d, int serial, double end, ReverseGop *gop)
+{
+    double time_base = av_q2d(d->format_ctx->streams[rd->stream_index]->time_base);
+    int64_t ts = llrint(end / time_base) - 1;
+    if (avformat_seek_file(d->format_ctx, rd->stream_index, INT64_MIN, ts, ts, AVSEEK_FLAG_BACKWARD) < 0)
+        return -1;
+    avcodec_flush_buffers(d->codec_ctx);
+
+    double start = NAN; // of the keyframe decoding starts from
+    bool draining = false;
+    while (!draining)
+    {
+        if (job_cancelled(rd, serial))
+            return -1;
+        if (av_read_frame(d->format_ctx, d->packet) < 0)
+        {
+            draining = true;
+        }
+        else if (d->packet->stream_index != rd->stream_index)
+        {
+            av_packet_unref(d->packet);
+            continue;
+        }
+        else
+        {
+            // Packets arrive in decode order and no frame decodes after it is
+            // shown, so past this one every frame before end has been sent.
+            int64_t dts = d->packet->dts != AV_NOPTS_VALUE ? d->packet->dts : d->packet->pts;
+            if (dts != AV_NOPTS_VALUE && dts * time_base >= end)
+            {
+                av_packet_unref(d->packet);
+                draining = true;
+            }
+            else if (isnan(start))
+            {
+                if (!(d->packet->flags & AV_PKT_FLAG_KEY))
+                {
+                    av_packet_unref(d->packet);
+                    continue;
+                }
+                start = d->packet->pts != AV_NOPTS_VALUE ? d->packet->pts * time_base : -INFINITY;
+            }
+        }
+
+        avcodec_send_packet(d->codec_ctx, draining ? NULL : d->packet);
+        av_packet_unref(d->packet);
+        while (avcodec_receive_frame(d->codec_ctx, d->frame) >= 0)
+        {
+            int64_t best_pts = d->frame->best_effort_timestamp;
+            double pts = best_pts == AV_NOPTS_VALUE ? NAN : best_pts * time_base;
+            // Leading pictures of an open GOP belong to the GOP before.
+            if (isnan(pts) || pts >= end || pts < start)
+            {
+                av_frame_unref(d->frame);
+                continue;
+            }
+            gop_append(gop, d->frame, pts);
+        }
+    }
+    return 0;
+}
+
+static void *reverse_thread(void *arg)
+{
+    ReverseDecoder *rd = arg;
+    GopDecoder d = {0};
+    bool opened = false;
+
+    pthread_mutex_lock(&rd->mutex);
+    for (;;)
+    {
+        while (!rd->abort_request && (isnan(rd->next_end) || rd->reached_start || rd->ready == REVERSE_GOP_BUFFERS))
+            pthread_cond_wait(&rd->cond, &rd->mutex);
+        if (rd->abort_request)
+            break;
+        int serial = rd->serial;
+        double end = rd->next_end;
+        ReverseGop *gop = &rd->gops[(rd->read_index + rd->ready) % REVERSE_GOP_BUFFERS];
+        pthread_mutex_unlock(&rd->mutex);
+
+        // Opened on first use, so files never played backwards pay nothing.
+        if (!opened && !(opened = open_decoder(rd, &d) == 0))
+        {
+            fprintf(stderr, "ERROR: Could not open reverse decoder\n");
+            close_decoder(&d);
+        }
+        int ret = opened ? decode_gop(rd, &d, serial, end, gop) : -1;
+
+        pthread_mutex_lock(&rd->mutex);
+        if (rd->abort_request || rd->serial != serial)
+        {
+            gop_clear(gop);
+        }
+        else if (ret < 0 || gop->count == 0)
+        {
+            gop_clear(gop);
+            rd->reached_start = true;
+            pthread_cond_broadcast(&rd->cond);
+        }
+        else
+        {
+            rd->next_end = gop->pts[0];
+            rd->ready++;
+            pthread_cond_broadcast(&rd->cond);
+        }
+    }
+    pthread_mutex_unlock(&rd->mutex);
+
+    close_decoder(&d);
+    return NULL;
+}
+
+// The thread starts idle and opens its demuxer and decoder on the first restart.
+int reverse_decoder_open(ReverseDecoder *rd, const char *filename, int stream_index)
+{
+    memset(rd, 0, sizeof(*rd));
+    pthread_mutex_init(&rd->mutex, NULL);
+    pthread_cond_init(&rd->cond, NULL);
+    rd->next_end = NAN;
+    rd->stream_index = stream_index;
+    if (!(rd->filename = strdup(filename)))
+    {
+        reverse_decoder_close(rd);
+        return -1;
+    }
+    if (pthread_create(&rd->thread, NULL, reverse_thread, rd) != 0)
+    {
+        fprintf(stderr, "ERROR: Could not start reverse decoder thread\n");
+        reverse_decoder_close(rd);
+        return -1;
+    }
+    rd->thread_running = true;
+    return 0;
+}
+
+// The GOP the thread may be decoding is not among the ready ones; it notices
+// the new serial and drops that one itself.
+static void drop_ready_locked(ReverseDecoder *rd)
+{
+    for (; rd->ready > 0; rd->ready--)
+    {
+        gop_clear(&rd->gops[rd->read_index]);
+        rd->read_index = (rd->read_index + 1) % REVERSE_GOP_BUFFERS;
+    }
+    rd->serial++;
+}
+
+// Discards everything buffered and starts over with the frames before time.
+void reverse_decoder_restart(ReverseDecoder *rd, double time)
+{
+    pthread_mutex_lock(&rd->mutex);
+    drop_ready_locked(rd);
+    rd->next_end = time;
+    rd->reached_start = false;
+    pthread_cond_broadcast(&rd->cond);
+    pthread_mutex_unlock(&rd->mutex);
+}
+
+// Releases the buffered GOPs and leaves the thread idle.
+void reverse_decoder_stop(ReverseDecoder *rd)
+{
+    pthread_mutex_lock(&rd->mutex);
+    drop_ready_locked(rd);
+    rd->next_end = NAN;
+    pthread_mutex_unlock(&rd->mutex);
+}
+
+// The latest decoded GOP, or NULL while it is still being decoded. It stays
+// valid until reverse_decoder_next(); has_next tells whether the one before it
+// is ready as well.
+ReverseGop *reverse_decoder_peek(ReverseDecoder *rd, bool *has_next)
+{
+    pthread_mutex_lock(&rd->mutex);
+    ReverseGop *gop = rd->ready > 0 ? &rd->gops[rd->read_index] : NULL;
+    *has_next = rd->ready > 1;
+    pthread_mutex_unlock(&rd->mutex);
+    return gop;
+}
+
+// Releases the GOP returned by reverse_decoder_peek(), making room for the next one.
+void reverse_decoder_next(ReverseDecoder *rd)
+{
+    pthread_mutex_lock(&rd->mutex);
+    if (rd->ready > 0)
+    {
+        gop_clear(&rd->gops[rd->read_index]);
+        rd->read_index = (rd->read_index + 1) % REVERSE_GOP_BUFFERS;
+        rd->ready--;
+        pthread_cond_broadcast(&rd->cond);
+    }
+    pthread_mutex_unlock(&rd->mutex);
+}
+
+// True once no GOP is left to decode before the ones already buffered.
+bool reverse_decoder_at_start(ReverseDecoder *rd)
+{
+    pthread_mutex_lock(&rd->mutex);
+    bool at_start = rd->reached_start;
+    pthread_mutex_unlock(&rd->mutex);
+    return at_start;
+}
+
+void reverse_decoder_close(ReverseDecoder *rd)
+{
+    if (rd->thread_running)
+    {
+        pthread_mutex_lock(&rd->mutex);
+        rd->abort_request = true;
+        pthread_cond_broadcast(&rd->cond);
+        pthread_mutex_unlock(&rd->mutex);
+        pthread_join(rd->thread, NULL);
+    }
+    for (int i = 0; i < REVERSE_GOP_BUFFERS; i++)
+        gop_clear(&rd->gops[i]);
+    free(rd->filename);
+    pthread_mutex_destroy(&rd->mutex);
+    pthread_cond_destroy(&rd->cond);
+    memset(rd, 0, sizeof(*rd));
+}
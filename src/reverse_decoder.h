@@ -0,0 +1,59 @@
+#ifndef REVERSE_DECODER_H
+#define REVERSE_DECODER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <libavutil/frame.h>
+
+// Memory one buffered GOP may hold. A GOP that does not fit is delivered in
+// pieces, latest first; each piece decodes again from the keyframe.
+#define REVERSE_GOP_BUDGET_MB 192
+#define REVERSE_GOP_MAX_FRAMES 512
+// One GOP on screen while the one before it is decoded.
+#define REVERSE_GOP_BUFFERS 2
+
+// The frames of one GOP, or of its tail, in presentation order.
+struct ReverseGop
+{
+    AVFrame *frames[REVERSE_GOP_MAX_FRAMES];
+    double pts[REVERSE_GOP_MAX_FRAMES]; // seconds
+    int count;
+    size_t bytes;
+};
+
+// Decodes GOPs backwards from a start time on a thread with its own demuxer and
+// decoder: it seeks to the keyframe before the earliest frame delivered so far,
+// decodes forward up to that frame and hands over the result, then moves on to
+// the GOP before while the render thread shows this one back to front.
+struct ReverseDecoder
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool thread_running;
+    bool abort_request;
+
+    char *filename;
+    int stream_index;
+
+    struct ReverseGop gops[REVERSE_GOP_BUFFERS];
+    int read_index; // GOP the render thread shows
+    int ready;      // decoded GOPs, starting at read_index
+    double next_end; // the next GOP is made of the frames before this time; NAN when idle
+    int serial;      // bumped by reverse_decoder_restart()
+    bool reached_start;
+};
+
+typedef struct ReverseGop ReverseGop;
+typedef struct ReverseDecoder ReverseDecoder;
+
+int reverse_decoder_open(ReverseDecoder *rd, const char *filename, int stream_index);
+void reverse_decoder_restart(ReverseDecoder *rd, double time);
+void reverse_decoder_stop(ReverseDecoder *rd);
+ReverseGop *reverse_decoder_peek(ReverseDecoder *rd, bool *has_next);
+void reverse_decoder_next(ReverseDecoder *rd);
+bool reverse_decoder_at_start(ReverseDecoder *rd);
+void reverse_decoder_close(ReverseDecoder *rd);
+
+#endif // REVERSE_DECODER_H
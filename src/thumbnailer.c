@@ -0,0 +1,372 @@
+#include "thumbnailer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#if defined(__APPLE__)
+#include <pthread/qos.h>
+#endif
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+#include <libavutil/opt.h>
+
+// Nice value of the thumbnail thread on Linux.
+#define THUMBNAIL_NICE 10
+// Packets read after a seek before giving up on finding a keyframe.
+#define THUMBNAIL_MAX_PACKETS 1000
+
+typedef struct
+{
+    AVFormatContext *format_ctx;
+    AVCodecContext *codec_ctx;
+    struct SwsContext *sws_ctx;
+    AVPacket *packet;
+    AVFrame *frame;
+} ThumbnailDecoder;
+
+static size_t thumbnail_size(const Thumbnailer *t)
+{
+    return (size_t)t->width * t->height * 4;
+}
+
+static off_t sheet_offset(const Thumbnailer *t, int slot)
+{
+    return (off_t)sizeof(ThumbnailSheetHeader) + THUMBNAIL_COUNT + (off_t)slot * thumbnail_size(t);
+}
+
+// Reuses the sheet when it was made for this file at this size, otherwise starts a new one.
+static void open_sheet(Thumbnailer *t)
+{
+    size_t len = strlen(t->filename) + sizeof(THUMBNAIL_SHEET_SUFFIX);
+    char *path = malloc(len);
+    if (!path)
+        return;
+    snprintf(path, len, "%s%s", t->filename, THUMBNAIL_SHEET_SUFFIX);
+    t->sheet_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (t->sheet_fd < 0)
+    {
+        fprintf(stderr, "WARNING: Could not open thumbnail sheet %s\n", path);
+        free(path);
+        return;
+    }
+    free(path);
+
+    ThumbnailSheetHeader header;
+    if (pread(t->sheet_fd, &header, sizeof(header), 0) == sizeof(header) &&
+        memcmp(header.magic, THUMBNAIL_SHEET_MAGIC, sizeof(header.magic)) == 0 &&
+        header.file_size == t->file_size && header.file_mtime == t->file_mtime && header.width == t->width &&
+        header.height == t->height && header.count == THUMBNAIL_COUNT &&
+        pread(t->sheet_fd, t->present, THUMBNAIL_COUNT, sizeof(header)) == THUMBNAIL_COUNT)
+        return;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, THUMBNAIL_SHEET_MAGIC, sizeof(header.magic));
+    header.file_size = t->file_size;
+    header.file_mtime = t->file_mtime;
+    header.width = t->width;
+    header.height = t->height;
+    header.count = THUMBNAIL_COUNT;
+    memset(t->present, 0, sizeof(t->present));
+    if (ftruncate(t->sheet_fd, 0) < 0 || pwrite(t->sheet_fd, &header, sizeof(header), 0) != sizeof(header) ||
+        pwrite(t->sheet_fd, t->present, THUMBNAIL_COUNT, sizeof(header)) != THUMBNAIL_COUNT)
+    {
+        close(t->sheet_fd);
+        t->sheet_fd = -1;
+    }
+}
+
+// Pixels first, then the presence byte, so an interrupted write leaves the slot absent.
+static void save_to_sheet(Thumbnailer *t, int slot, const uint8_t *rgba)
+{
+    if (t->sheet_fd < 0)
+        return;
+    uint8_t present = 1;
+    if (pwrite(t->sheet_fd, rgba, thumbnail_size(t), sheet_offset(t, slot)) == (ssize_t)thumbnail_size(t) &&
+        pwrite(t->sheet_fd, &present, 1, sizeof(ThumbnailSheetHeader) + slot) == 1)
+        t->present[slot] = 1;
+}
+
+static bool load_from_sheet(Thumbnailer *t, int slot, uint8_t *rgba)
+{
+    if (t->sheet_fd < 0 || !t->present[slot])
+        return false;
+    return pread(t->sheet_fd, rgba, thumbnail_size(t), sheet_offset(t, slot)) == (ssize_t)thumbnail_size(t);
+}
+
+static ThumbnailEntry *find_entry(Thumbnailer *t, int slot)
+{
+    for (int i = 0; i < THUMBNAIL_CACHE_SIZE; i++)
+    {
+        if (t->cache[i].slot == slot)
+            return &t->cache[i];
+    }
+    return NULL;
+}
+
+// Takes a free entry, or evicts the least recently used one.
+static void store_entry(Thumbnailer *t, int slot, const uint8_t *rgba)
+{
+    ThumbnailEntry *victim = &t->cache[0];
+    for (int i = 0; i < THUMBNAIL_CACHE_SIZE; i++)
+    {
+        ThumbnailEntry *entry = &t->cache[i];
+        if (entry->slot < 0)
+        {
+            victim = entry;
+            break;
+        }
+        if (entry->last_used < victim->last_used)
+            victim = entry;
+    }
+    if (!victim->rgba)
+        victim->rgba = malloc(thumbnail_size(t));
+    if (!victim->rgba)
+        return;
+    memcpy(victim->rgba, rgba, thumbnail_size(t));
+    victim->slot = slot;
+    victim->last_used = ++t->use_counter;
+}
+
+static bool thumbnailer_aborted(Thumbnailer *t)
+{
+    pthread_mutex_lock(&t->mutex);
+    bool aborted = t->abort_request;
+    pthread_mutex_unlock(&t->mutex);
+    return aborted;
+}
+
+static int interrupt_callback(void *opaque)
+{
+    return thumbnailer_aborted(opaque);
+}
+
+static void lower_thread_priority(void)
+{
+#if defined(__APPLE__)
+    pthread_set_qos_class_self_np(QOS_CLASS_UTILITY, 0);
+#elif defined(__linux__)
+    // Nice values are per thread on Linux, so this leaves the player alone.
+    setpriority(PRIO_PROCESS, 0, THUMBNAIL_NICE);
+#endif
+}
+
+static void close_decoder(ThumbnailDecoder *d)
+{
+    sws_freeContext(d->sws_ctx);
+    av_frame_free(&d->frame);
+    av_packet_free(&d->packet);
+    avcodec_free_context(&d->codec_ctx);
+    avformat_close_input(&d->format_ctx);
+}
+
+// Keyframes only, single-threaded, and with the largest lowres factor the codec
+// supports that still leaves at least the thumbnail width.
+static int open_decoder(Thumbnailer *t, ThumbnailDecoder *d)
+{
+    d->format_ctx = avformat_alloc_context();
+    d->packet = av_packet_alloc();
+    d->frame = av_frame_alloc();
+    if (!d->format_ctx || !d->packet || !d->frame)
+        return -1;
+    d->format_ctx->interrupt_callback = (AVIOInterruptCB){.callback = interrupt_callback, .opaque = t};
+    if (avformat_open_input(&d->format_ctx, t->filename, NULL, NULL) < 0 ||
+        avformat_find_stream_info(d->format_ctx, NULL) < 0 || t->stream_index >= (int)d->format_ctx->nb_streams)
+        return -1;
+    for (unsigned int i = 0; i < d->format_ctx->nb_streams; i++)
+    {
+        if ((int)i != t->stream_index)
+            d->format_ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    AVStream *stream = d->format_ctx->streams[t->stream_index];
+    const AVCodec *codec = avcodec_find_decoder(stream->codecpar->codec_id);
+    if (!codec)
+        return -1;
+    d->codec_ctx = avcodec_alloc_context3(codec);
+    if (!d->codec_ctx || avcodec_parameters_to_context(d->codec_ctx, stream->codecpar) < 0)
+        return -1;
+    int lowres = 0;
+    while (lowres < codec->max_lowres && (stream->codecpar->width >> (lowres + 1)) >= t->width)
+        lowres++;
+    d->codec_ctx->lowres = lowres;
+    d->codec_ctx->thread_count = 1;
+    d->codec_ctx->skip_frame = AVDISCARD_NONKEY;
+    return avcodec_open2(d->codec_ctx, codec, NULL);
+}
+
+// Decodes the first keyframe at or before the middle of the slot.
+static bool decode_thumbnail(Thumbnailer *t, ThumbnailDecoder *d, int slot, uint8_t *rgba)
+{
+    AVStream *stream = d->format_ctx->streams[t->stream_index];
+    double time = (slot + 0.5) * t->duration / THUMBNAIL_COUNT;
+    int64_t ts = (int64_t)(time / av_q2d(stream->time_base));
+    if (avformat_seek_file(d->format_ctx, t->stream_index, INT64_MIN, ts, ts, AVSEEK_FLAG_BACKWARD) < 0 &&
+        avformat_seek_file(d->format_ctx, t->stream_index, INT64_MIN, ts, INT64_MAX, 0) < 0)
+        return false;
+    avcodec_flush_buffers(d->codec_ctx);
+
+    bool found = false;
+    for (int packets = 0; !found && packets < THUMBNAIL_MAX_PACKETS; packets++)
+    {
+        if (av_read_frame(d->format_ctx, d->packet) < 0)
+            break;
+        int ret = d->packet->stream_index == t->stream_index ? avcodec_send_packet(d->codec_ctx, d->packet) : -1;
+        av_packet_unref(d->packet);
+        if (ret < 0)
+            continue;
+        if (avcodec_receive_frame(d->codec_ctx, d->frame) < 0)
+            continue;
+
+        d->sws_ctx = sws_getCachedContext(d->sws_ctx, d->frame->width, d->frame->height, d->frame->format, t->width,
+                                          t->height, AV_PIX_FMT_RGBA, SWS_BILINEAR, NULL, NULL, NULL);
+        if (d->sws_ctx)
+        {
+            int linesize = t->width * 4;
+            sws_scale(d->sws_ctx, (const uint8_t *const *)d->frame->data, d->frame->linesize, 0, d->frame->height,
+                      &rgba, &linesize);
+            found = true;
+        }
+        av_frame_unref(d->frame);
+    }
+    return found;
+}
+
+static void *thumbnail_thread(void *arg)
+{
+    Thumbnailer *t = arg;
+    ThumbnailDecoder d = {0};
+    uint8_t *rgba = malloc(thumbnail_size(t));
+    lower_thread_priority();
+    if (!rgba || open_decoder(t, &d) < 0)
+    {
+        fprintf(stderr, "ERROR: Could not open thumbnail decoder\n");
+        goto end;
+    }
+
+    for (;;)
+    {
+        pthread_mutex_lock(&t->mutex);
+        while (!t->abort_request && t->requested_slot < 0)
+            pthread_cond_wait(&t->cond, &t->mutex);
+        if (t->abort_request)
+        {
+            pthread_mutex_unlock(&t->mutex);
+            break;
+        }
+        int slot = t->requested_slot;
+        t->requested_slot = -1;
+        bool cached = find_entry(t, slot) != NULL;
+        pthread_mutex_unlock(&t->mutex);
+        if (cached)
+            continue;
+
+        bool ok = load_from_sheet(t, slot, rgba);
+        if (!ok && (ok = decode_thumbnail(t, &d, slot, rgba)))
+            save_to_sheet(t, slot, rgba);
+        if (ok)
+        {
+            pthread_mutex_lock(&t->mutex);
+            store_entry(t, slot, rgba);
+            pthread_mutex_unlock(&t->mutex);
+        }
+    }
+
+end:
+    close_decoder(&d);
+    free(rgba);
+    return NULL;
+}
+
+// persist keeps thumbnails in a sprite sheet next to the file for later runs.
+// On failure the thumbnailer is left closed.
+int thumbnailer_open(Thumbnailer *t, const char *filename, int stream_index, int source_width, int source_height,
+                     double duration, bool persist)
+{
+    memset(t, 0, sizeof(*t));
+    pthread_mutex_init(&t->mutex, NULL);
+    pthread_cond_init(&t->cond, NULL);
+    t->requested_slot = -1;
+    t->sheet_fd = -1;
+    for (int i = 0; i < THUMBNAIL_CACHE_SIZE; i++)
+        t->cache[i].slot = -1;
+
+    if (duration <= 0 || source_width <= 0 || source_height <= 0 || !(t->filename = strdup(filename)))
+    {
+        thumbnailer_close(t);
+        return -1;
+    }
+    t->stream_index = stream_index;
+    t->duration = duration;
+    t->width = THUMBNAIL_WIDTH;
+    t->height = (THUMBNAIL_WIDTH * source_height / source_width + 1) & ~1;
+
+    struct stat st;
+    if (persist && stat(filename, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        t->file_size = st.st_size;
+        t->file_mtime = st.st_mtime;
+        open_sheet(t);
+    }
+
+    if (pthread_create(&t->thread, NULL, thumbnail_thread, t) != 0)
+    {
+        fprintf(stderr, "ERROR: Could not start thumbnail thread\n");
+        thumbnailer_close(t);
+        return -1;
+    }
+    t->thread_running = true;
+    return 0;
+}
+
+int thumbnailer_slot(Thumbnailer *t, double time)
+{
+    int slot = (int)(time / t->duration * THUMBNAIL_COUNT);
+    return slot < 0 ? 0 : slot >= THUMBNAIL_COUNT ? THUMBNAIL_COUNT - 1 : slot;
+}
+
+// Copies the slot's thumbnail into rgba (width * height * 4 bytes) when it is
+// cached. Otherwise asks the thread for it, replacing any older request, and
+// returns false without waiting.
+bool thumbnailer_get(Thumbnailer *t, int slot, uint8_t *rgba)
+{
+    pthread_mutex_lock(&t->mutex);
+    ThumbnailEntry *entry = find_entry(t, slot);
+    if (entry)
+    {
+        memcpy(rgba, entry->rgba, thumbnail_size(t));
+        entry->last_used = ++t->use_counter;
+    }
+    else
+    {
+        t->requested_slot = slot;
+        pthread_cond_signal(&t->cond);
+    }
+    pthread_mutex_unlock(&t->mutex);
+    return entry != NULL;
+}
+
+void thumbnailer_close(Thumbnailer *t)
+{
+    if (t->thread_running)
+    {
+        pthread_mutex_lock(&t->mutex);
+        t->abort_request = true;
+        pthread_cond_signal(&t->cond);
+        pthread_mutex_unlock(&t->mutex);
+        pthread_join(t->thread, NULL);
+    }
+    if (t->sheet_fd >= 0)
+        close(t->sheet_fd);
+    for (int i = 0; i < THUMBNAIL_CACHE_SIZE; i++)
+        free(t->cache[i].rgba);
+    free(t->filename);
+    pthread_mutex_destroy(&t->mutex);
+    pthread_cond_destroy(&t->cond);
+    memset(t, 0, sizeof(*t));
+    t->sheet_fd = -1;
+}
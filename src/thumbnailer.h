@@ -0,0 +1,74 @@
+#ifndef THUMBNAILER_H
+#define THUMBNAILER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// The timeline is split into THUMBNAIL_COUNT slots, one thumbnail each.
+#define THUMBNAIL_WIDTH 160
+#define THUMBNAIL_COUNT 200
+#define THUMBNAIL_CACHE_SIZE 48 // thumbnails kept in memory, least recently used goes first
+
+// Sprite sheet written next to the media file: this header, one presence byte
+// per slot, then THUMBNAIL_COUNT RGBA thumbnails stacked top to bottom.
+#define THUMBNAIL_SHEET_SUFFIX ".avpthumbs"
+#define THUMBNAIL_SHEET_MAGIC "AVPTHM01"
+
+struct ThumbnailSheetHeader
+{
+    char magic[8];
+    int64_t file_size;
+    int64_t file_mtime;
+    int32_t width;
+    int32_t height;
+    int32_t count;
+    int32_t reserved;
+};
+
+struct ThumbnailEntry
+{
+    int slot; // -1 when unused
+    uint64_t last_used;
+    uint8_t *rgba;
+};
+
+// Produces thumbnails on a low-priority thread with its own demuxer and decoder,
+// which only decodes keyframes and at reduced resolution where the codec can.
+// The render thread never waits on it: a thumbnail that is not cached yet is
+// requested and shows up on a later frame.
+struct Thumbnailer
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool thread_running;
+    bool abort_request;
+    int requested_slot; // latest request, replaced by newer ones; -1 for none
+
+    char *filename;
+    int stream_index;
+    double duration; // seconds
+    int width;
+    int height;
+
+    struct ThumbnailEntry cache[THUMBNAIL_CACHE_SIZE];
+    uint64_t use_counter;
+
+    int sheet_fd; // -1 when not persisting
+    uint8_t present[THUMBNAIL_COUNT]; // slots already in the sheet
+    int64_t file_size;
+    int64_t file_mtime;
+};
+
+typedef struct ThumbnailSheetHeader ThumbnailSheetHeader;
+typedef struct ThumbnailEntry ThumbnailEntry;
+typedef struct Thumbnailer Thumbnailer;
+
+int thumbnailer_open(Thumbnailer *t, const char *filename, int stream_index, int source_width, int source_height,
+                     double duration, bool persist);
+int thumbnailer_slot(Thumbnailer *t, double time);
+bool thumbnailer_get(Thumbnailer *t, int slot, uint8_t *rgba);
+void thumbnailer_close(Thumbnailer *t);
+
+#endif // THUMBNAILER_H
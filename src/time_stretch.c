@@ -0,0 +1,260 @@
+#include "time_stretch.h"
+
+#include <math.h>
+#include <string.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TIME_STRETCH_X86 1
+#endif
+
+typedef float (*DotProduct)(const float *a, const float *b, int n);
+
+static float dot_scalar(const float *a, const float *b, int n)
+{
+    float sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+#ifdef TIME_STRETCH_X86
+
+__attribute__((target("sse"))) static float dot_sse(const float *a, const float *b, int n)
+{
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(sum0, sum1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,fma"))) static float dot_avx2(const float *a, const float *b, int n)
+{
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+        sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), sum1);
+    }
+    __m256 sum = _mm256_add_ps(sum0, sum1);
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, half);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_scalar(a + i, b + i, n - i);
+}
+
+#endif // TIME_STRETCH_X86
+
+static DotProduct dot_kernel;
+static const char *dot_kernel_name;
+
+static void select_kernel(void)
+{
+    if (dot_kernel_name)
+        return;
+    dot_kernel = dot_scalar;
+    dot_kernel_name = "scalar";
+#ifdef TIME_STRETCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        dot_kernel = dot_avx2;
+        dot_kernel_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse"))
+    {
+        dot_kernel = dot_sse;
+        dot_kernel_name = "sse";
+    }
+#endif
+}
+
+const char *time_stretch_kernel_name(void)
+{
+    select_kernel();
+    return dot_kernel_name;
+}
+
+int time_stretch_init(TimeStretch *ts, int sample_rate)
+{
+    memset(ts, 0, sizeof(*ts));
+    select_kernel();
+    ts->sample_rate = sample_rate;
+    ts->speed = 1.0;
+    ts->sequence = sample_rate * STRETCH_SEQUENCE_MS / 1000;
+    ts->overlap = sample_rate * STRETCH_OVERLAP_MS / 1000;
+    ts->seek_window = sample_rate * STRETCH_SEEK_MS / 1000;
+    ts->tail = av_malloc_array(ts->overlap * 2, sizeof(float));
+    if (!ts->tail)
+        return AVERROR(ENOMEM);
+    return 0;
+}
+
+void time_stretch_free(TimeStretch *ts)
+{
+    av_freep(&ts->input);
+    av_freep(&ts->tail);
+    av_freep(&ts->output);
+}
+
+// Drops buffered audio, for after a seek.
+void time_stretch_reset(TimeStretch *ts)
+{
+    ts->input_count = 0;
+    ts->skip_pending = 0;
+    ts->skip_fraction = 0;
+    ts->has_tail = false;
+}
+
+void time_stretch_set_speed(TimeStretch *ts, double speed)
+{
+    ts->speed = speed;
+}
+
+// Input received but not yet reflected in the output, in seconds.
+double time_stretch_pending(const TimeStretch *ts)
+{
+    return (double)(ts->input_count - ts->skip_pending) / ts->sample_rate;
+}
+
+static int grow(float **buffer, int *capacity, int frames)
+{
+    if (frames <= *capacity)
+        return 0;
+    int new_capacity = frames * 2;
+    float *grown = av_realloc_array(*buffer, new_capacity * 2, sizeof(float));
+    if (!grown)
+        return AVERROR(ENOMEM);
+    *buffer = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static void consume_input(TimeStretch *ts, int frames)
+{
+    if (frames >= ts->input_count)
+    {
+        ts->skip_pending += frames - ts->input_count;
+        ts->input_count = 0;
+        return;
+    }
+    ts->input_count -= frames;
+    memmove(ts->input, ts->input + frames * 2, ts->input_count * 2 * sizeof(float));
+}
+
+// Offset into the input, within the seek window, whose start matches the tail
+// of the last sequence best: normalized cross-correlation over the overlap.
+static int best_offset(const TimeStretch *ts)
+{
+    int n = ts->overlap * 2;
+    double energy = 0;
+    for (int i = 0; i < n; i++)
+        energy += ts->input[i] * ts->input[i];
+
+    int best = 0;
+    double best_score = -INFINITY;
+    for (int offset = 0; offset < ts->seek_window; offset++)
+    {
+        const float *candidate = ts->input + offset * 2;
+        double score = dot_kernel(ts->tail, candidate, n) / sqrt(energy > 1e-9 ? energy : 1e-9);
+        if (score > best_score)
+        {
+            best_score = score;
+            best = offset;
+        }
+        // Slide the energy window one sample frame along.
+        energy += candidate[n] * candidate[n] + candidate[n + 1] * candidate[n + 1] - candidate[0] * candidate[0] -
+                  candidate[1] * candidate[1];
+    }
+    return best;
+}
+
+static void cross_fade(float *dst, const float *from, const float *to, int frames)
+{
+    for (int i = 0; i < frames; i++)
+    {
+        float t = (float)i / frames;
+        dst[2 * i] = from[2 * i] + (to[2 * i] - from[2 * i]) * t;
+        dst[2 * i + 1] = from[2 * i + 1] + (to[2 * i + 1] - from[2 * i + 1]) * t;
+    }
+}
+
+// Takes frames of interleaved stereo input and points output at the audio it
+// completes, valid until the next call. Returns the number of output frames,
+// which may be 0 while input is being gathered.
+int time_stretch_process(TimeStretch *ts, const float *input, int frames, float **output)
+{
+    int dropped = frames < ts->skip_pending ? frames : ts->skip_pending;
+    ts->skip_pending -= dropped;
+    input += dropped * 2;
+    frames -= dropped;
+    if (grow(&ts->input, &ts->input_capacity, ts->input_count + frames) < 0)
+        return AVERROR(ENOMEM);
+    memcpy(ts->input + ts->input_count * 2, input, frames * 2 * sizeof(float));
+    ts->input_count += frames;
+
+    int hop = ts->sequence - ts->overlap;
+    int produced = 0;
+    while (ts->input_count >= ts->seek_window + ts->sequence)
+    {
+        if (grow(&ts->output, &ts->output_capacity, produced + hop) < 0)
+            return AVERROR(ENOMEM);
+        float *dst = ts->output + produced * 2;
+        const float *src = ts->input;
+        if (ts->has_tail)
+        {
+            src += best_offset(ts) * 2;
+            cross_fade(dst, ts->tail, src, ts->overlap);
+        }
+        else
+        {
+            memcpy(dst, src, ts->overlap * 2 * sizeof(float));
+        }
+        memcpy(dst + ts->overlap * 2, src + ts->overlap * 2, (hop - ts->overlap) * 2 * sizeof(float));
+        memcpy(ts->tail, src + hop * 2, ts->overlap * 2 * sizeof(float));
+        ts->has_tail = true;
+        produced += hop;
+
+        // The input moves on by speed times what was output.
+        ts->skip_fraction += hop * ts->speed;
+        int skip = (int)ts->skip_fraction;
+        ts->skip_fraction -= skip;
+        consume_input(ts, skip);
+    }
+    *output = ts->output;
+    return produced;
+}
+
+// Lets the pending input out as it is, faded in from the last sequence, and
+// starts over; for when the caller stops stretching. Output is as for
+// time_stretch_process().
+int time_stretch_drain(TimeStretch *ts, float **output)
+{
+    int frames = ts->input_count;
+    if (grow(&ts->output, &ts->output_capacity, frames) < 0)
+    {
+        time_stretch_reset(ts);
+        return AVERROR(ENOMEM);
+    }
+    int faded = 0;
+    if (ts->has_tail && frames >= ts->overlap)
+    {
+        cross_fade(ts->output, ts->tail, ts->input, ts->overlap);
+        faded = ts->overlap;
+    }
+    memcpy(ts->output + faded * 2, ts->input + faded * 2, (frames - faded) * 2 * sizeof(float));
+    time_stretch_reset(ts);
+    *output = ts->output;
+    return frames;
+}
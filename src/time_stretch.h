@@ -0,0 +1,48 @@
+#ifndef TIME_STRETCH_H
+#define TIME_STRETCH_H
+
+#include <stdbool.h>
+
+// WSOLA parameters, in milliseconds: each sequence is spliced onto the last one
+// across the overlap, at the offset within the seek window where the two match
+// best. Longer sequences suit music, shorter ones speech.
+#define STRETCH_SEQUENCE_MS 40
+#define STRETCH_OVERLAP_MS 8
+#define STRETCH_SEEK_MS 15
+
+// Changes the tempo of interleaved stereo float audio without changing its
+// pitch. Runs on the audio decode thread; the correlation search uses SSE or
+// AVX2 kernels picked from CPUID on first use.
+struct TimeStretch
+{
+    int sample_rate;
+    double speed; // input consumed per output sample
+    int sequence; // sample frames
+    int overlap;
+    int seek_window;
+
+    float *input; // pending input
+    int input_count;
+    int input_capacity;
+    int skip_pending; // input to drop as it arrives, when a skip ran past the end
+    double skip_fraction;
+
+    float *tail; // end of the last sequence, to cross-fade into the next
+    bool has_tail;
+
+    float *output;
+    int output_capacity;
+};
+
+typedef struct TimeStretch TimeStretch;
+
+int time_stretch_init(TimeStretch *ts, int sample_rate);
+void time_stretch_free(TimeStretch *ts);
+void time_stretch_reset(TimeStretch *ts);
+void time_stretch_set_speed(TimeStretch *ts, double speed);
+int time_stretch_process(TimeStretch *ts, const float *input, int frames, float **output);
+int time_stretch_drain(TimeStretch *ts, float **output);
+double time_stretch_pending(const TimeStretch *ts);
+const char *time_stretch_kernel_name(void);
+
+#endif // TIME_STRETCH_H
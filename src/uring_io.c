@@ -0,0 +1,377 @@
+// For O_DIRECT.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "uring_io.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#if defined(__linux__) && defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#else
+#define HAVE_IO_URING 0
+#endif
+
+#if HAVE_IO_URING
+
+// The rings are shared with the kernel: it reads the SQ tail and writes the
+// CQ tail, so those need acquire/release ordering on our side.
+#define LOAD_ACQUIRE(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static int uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    int ret;
+    do
+        ret = (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+    while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+static struct UringBlock *block_for(UringIO *io, int64_t offset)
+{
+    return &io->blocks[(offset / URING_IO_BLOCK_BYTES) % URING_IO_BLOCKS];
+}
+
+static int map_rings(UringIO *io, const struct io_uring_params *p)
+{
+    io->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    io->cq_ring_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP)
+        io->sq_ring_size = io->cq_ring_size = FFMAX(io->sq_ring_size, io->cq_ring_size);
+
+    io->sq_ring = mmap(NULL, io->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring_fd,
+                       IORING_OFF_SQ_RING);
+    if (io->sq_ring == MAP_FAILED)
+        return -1;
+    if (p->features & IORING_FEAT_SINGLE_MMAP)
+        io->cq_ring = io->sq_ring;
+    else
+        io->cq_ring = mmap(NULL, io->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring_fd,
+                           IORING_OFF_CQ_RING);
+    if (io->cq_ring == MAP_FAILED)
+        return -1;
+    io->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    io->sqes = mmap(NULL, io->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring_fd,
+                    IORING_OFF_SQES);
+    if (io->sqes == MAP_FAILED)
+        return -1;
+
+    uint8_t *sq = io->sq_ring;
+    uint8_t *cq = io->cq_ring;
+    io->sq_tail = (unsigned *)(sq + p->sq_off.tail);
+    io->sq_mask = (unsigned *)(sq + p->sq_off.ring_mask);
+    io->sq_array = (unsigned *)(sq + p->sq_off.array);
+    io->cq_head = (unsigned *)(cq + p->cq_off.head);
+    io->cq_tail = (unsigned *)(cq + p->cq_off.tail);
+    io->cq_mask = (unsigned *)(cq + p->cq_off.ring_mask);
+    io->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+    return 0;
+}
+
+// Queues a read of the part of the block past what it already holds; it goes
+// to the kernel with the next flush_reads().
+static void queue_read(UringIO *io, struct UringBlock *block)
+{
+    int index = (int)(block - io->blocks);
+    unsigned tail = *io->sq_tail;
+    unsigned slot = tail & *io->sq_mask;
+    struct io_uring_sqe *sqe = &io->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = io->registered ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = io->fd;
+    sqe->off = block->offset + block->length;
+    sqe->addr = (uint64_t)(uintptr_t)(io->buffers + (size_t)index * URING_IO_BLOCK_BYTES + block->length);
+    sqe->len = URING_IO_BLOCK_BYTES - block->length;
+    sqe->buf_index = io->registered ? index : 0;
+    sqe->user_data = index;
+    io->sq_array[slot] = slot;
+    STORE_RELEASE(io->sq_tail, tail + 1);
+
+    block->state = URING_BLOCK_IN_FLIGHT;
+    io->sq_pending++;
+    io->in_flight++;
+}
+
+static void queue_block(UringIO *io, struct UringBlock *block, int64_t offset)
+{
+    block->offset = offset;
+    block->length = 0;
+    block->resumed = false;
+    block->at_end = false;
+    queue_read(io, block);
+}
+
+static int flush_reads(UringIO *io)
+{
+    if (io->sq_pending == 0)
+        return 0;
+    int ret = uring_enter(io->ring_fd, io->sq_pending, 0, 0);
+    if (ret < 0)
+        return AVERROR(errno);
+    io->sq_pending -= ret;
+    return 0;
+}
+
+static void reap_completions(UringIO *io)
+{
+    unsigned head = *io->cq_head;
+    unsigned tail = LOAD_ACQUIRE(io->cq_tail);
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe *cqe = &io->cqes[head & *io->cq_mask];
+        struct UringBlock *block = &io->blocks[cqe->user_data];
+        if (cqe->res >= 0)
+        {
+            // Nothing at all, a second short read, or an O_DIRECT one that
+            // stops off alignment: the file ends there, whatever its size said.
+            int wanted = URING_IO_BLOCK_BYTES - block->length;
+            block->length += cqe->res;
+            block->at_end = cqe->res < wanted && (cqe->res == 0 || block->resumed ||
+                                                  (io->direct && block->length % URING_IO_ALIGN != 0));
+            block->state = URING_BLOCK_READY;
+        }
+        else
+        {
+            block->state = URING_BLOCK_FAILED;
+            block->error = AVERROR(-cqe->res);
+        }
+        io->in_flight--;
+    }
+    STORE_RELEASE(io->cq_head, head);
+}
+
+static int wait_completion(UringIO *io)
+{
+    if (uring_enter(io->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0)
+        return AVERROR(errno);
+    reap_completions(io);
+    return 0;
+}
+
+// Starts reads for the blocks from the one holding pos onwards that are
+// neither buffered nor on their way. A buffer still busy with a read from
+// before a seek is left alone; the next call gets to it.
+static int fill_ahead(UringIO *io)
+{
+    int64_t base = io->pos - io->pos % URING_IO_BLOCK_BYTES;
+    for (int i = 0; i < URING_IO_READS_AHEAD; i++)
+    {
+        int64_t offset = base + (int64_t)i * URING_IO_BLOCK_BYTES;
+        if (offset >= io->size)
+            break;
+        struct UringBlock *block = block_for(io, offset);
+        if (block->state == URING_BLOCK_IN_FLIGHT || (block->state == URING_BLOCK_READY && block->offset == offset))
+            continue;
+        if (block->state == URING_BLOCK_FAILED && block->offset == offset && i == 0)
+            continue; // reported by read_packet() first
+        queue_block(io, block, offset);
+    }
+    return flush_reads(io);
+}
+
+static int read_packet(void *opaque, uint8_t *buf, int size)
+{
+    UringIO *io = opaque;
+    for (;;)
+    {
+        if (io->pos >= io->size)
+            return AVERROR_EOF;
+        reap_completions(io);
+        int ret = fill_ahead(io);
+        if (ret < 0)
+            return ret;
+
+        int64_t base = io->pos - io->pos % URING_IO_BLOCK_BYTES;
+        struct UringBlock *block = block_for(io, base);
+        if (block->offset == base && block->state == URING_BLOCK_READY)
+        {
+            if (io->pos < base + block->length)
+            {
+                int n = (int)FFMIN((int64_t)size, base + block->length - io->pos);
+                memcpy(buf, io->buffers + (block - io->blocks) * (size_t)URING_IO_BLOCK_BYTES + (io->pos - base), n);
+                io->pos += n;
+                return n;
+            }
+            // A short read before the end of the file is continued once, from
+            // where it stopped; the file may have been truncated since open.
+            if (base + block->length >= io->size || block->at_end)
+                return AVERROR_EOF;
+            block->resumed = true;
+            queue_read(io, block);
+            if ((ret = flush_reads(io)) < 0)
+                return ret;
+            continue;
+        }
+        if (block->offset == base && block->state == URING_BLOCK_FAILED)
+        {
+            block->state = URING_BLOCK_EMPTY;
+            return block->error;
+        }
+
+        // On its way, or the buffer is still busy with an older read.
+        ret = wait_completion(io);
+        if (ret < 0)
+            return ret;
+    }
+}
+
+// Only moves pos: the next read finds whatever is still buffered there and
+// reads the rest.
+static int64_t seek_packet(void *opaque, int64_t offset, int whence)
+{
+    UringIO *io = opaque;
+    int64_t target = input_io_seek_target(offset, whence, io->pos, io->size);
+    if (target < 0 || (whence & AVSEEK_SIZE))
+        return target;
+    io->pos = target;
+    return target;
+}
+
+// Kernels before 5.6 cannot be probed, but READ_FIXED came with io_uring
+// itself; plain READ did not.
+static bool opcode_supported(UringIO *io, int opcode)
+{
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (!probe)
+        return false;
+    bool supported;
+    if (syscall(__NR_io_uring_register, io->ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0)
+        supported = opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+    else
+        supported = opcode == IORING_OP_READ_FIXED;
+    free(probe);
+    return supported;
+}
+
+// Filesystems without O_DIRECT refuse it at open, and get the page cache.
+static int open_file(UringIO *io, const char *filename)
+{
+    struct stat st;
+    io->fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (io->fd < 0 || fstat(io->fd, &st) < 0 || !S_ISREG(st.st_mode))
+        return -1;
+    io->size = st.st_size;
+    if (io->size < URING_IO_DIRECT_MIN_BYTES)
+        return 0;
+
+    int fd = open(filename, O_RDONLY | O_CLOEXEC | O_DIRECT);
+    if (fd >= 0)
+    {
+        close(io->fd);
+        io->fd = fd;
+        io->direct = true;
+    }
+    return 0;
+}
+
+// Also fails where the kernel lacks io_uring or does not let this process use it.
+int uring_io_open(UringIO *io, const char *filename)
+{
+    memset(io, 0, sizeof(*io));
+    io->ring_fd = -1;
+    io->sq_ring = io->cq_ring = io->sqes = MAP_FAILED;
+    if (open_file(io, filename) < 0)
+    {
+        uring_io_close(io);
+        return -1;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    io->ring_fd = (int)syscall(__NR_io_uring_setup, URING_IO_BLOCKS, &params);
+    if (io->ring_fd < 0 || map_rings(io, &params) < 0)
+    {
+        uring_io_close(io);
+        return -1;
+    }
+
+    if (posix_memalign((void **)&io->buffers, URING_IO_ALIGN, (size_t)URING_IO_BLOCKS * URING_IO_BLOCK_BYTES) != 0)
+    {
+        io->buffers = NULL;
+        fprintf(stderr, "ERROR: Could not allocate io_uring buffers\n");
+        uring_io_close(io);
+        return -1;
+    }
+    // Registration pins the buffers, which RLIMIT_MEMLOCK can forbid; plain
+    // reads then do the same job with a page walk per read.
+    struct iovec iov[URING_IO_BLOCKS];
+    for (int i = 0; i < URING_IO_BLOCKS; i++)
+    {
+        iov[i].iov_base = io->buffers + (size_t)i * URING_IO_BLOCK_BYTES;
+        iov[i].iov_len = URING_IO_BLOCK_BYTES;
+    }
+    io->registered =
+        syscall(__NR_io_uring_register, io->ring_fd, IORING_REGISTER_BUFFERS, iov, URING_IO_BLOCKS) == 0;
+    if (!opcode_supported(io, io->registered ? IORING_OP_READ_FIXED : IORING_OP_READ))
+    {
+        uring_io_close(io);
+        return -1;
+    }
+
+    io->avio = input_io_alloc(io, read_packet, seek_packet);
+    if (!io->avio)
+    {
+        uring_io_close(io);
+        return -1;
+    }
+    fill_ahead(io);
+    return 0;
+}
+
+// Reads still in flight write into the buffers, so they are waited for.
+void uring_io_close(UringIO *io)
+{
+    while (io->in_flight > 0 && wait_completion(io) == 0)
+        ;
+    input_io_free(&io->avio);
+    if (io->ring_fd >= 0)
+        close(io->ring_fd);
+    if (io->sqes != MAP_FAILED)
+        munmap(io->sqes, io->sqes_size);
+    if (io->cq_ring != MAP_FAILED && io->cq_ring != io->sq_ring)
+        munmap(io->cq_ring, io->cq_ring_size);
+    if (io->sq_ring != MAP_FAILED)
+        munmap(io->sq_ring, io->sq_ring_size);
+    free(io->buffers);
+    if (io->fd >= 0)
+        close(io->fd);
+    memset(io, 0, sizeof(*io));
+    io->fd = -1;
+    io->ring_fd = -1;
+}
+
+#else
+
+int uring_io_open(UringIO *io, const char *filename)
+{
+    (void)filename;
+    memset(io, 0, sizeof(*io));
+    io->fd = -1;
+    io->ring_fd = -1;
+    return -1;
+}
+
+void uring_io_close(UringIO *io)
+{
+    memset(io, 0, sizeof(*io));
+    io->fd = -1;
+    io->ring_fd = -1;
+}
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef URING_IO_H
+#define URING_IO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "input_io.h"
+
+// The file is read in blocks of this size into a fixed set of buffers, with
+// reads kept in flight for the blocks ahead of the position; the remaining
+// buffers keep the blocks just behind it for short backward seeks.
+#define URING_IO_BLOCKS 16
+#define URING_IO_READS_AHEAD 12
+#define URING_IO_BLOCK_BYTES (1024 * 1024)
+// Files at least this large bypass the page cache, where they would only push
+// out everything else without ever being read twice.
+#define URING_IO_DIRECT_MIN_BYTES (4LL * 1024 * 1024 * 1024)
+// O_DIRECT wants buffers, offsets and lengths aligned to the logical block size.
+#define URING_IO_ALIGN 4096
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+enum UringBlockState
+{
+    URING_BLOCK_EMPTY,
+    URING_BLOCK_IN_FLIGHT,
+    URING_BLOCK_READY,
+    URING_BLOCK_FAILED,
+};
+
+struct UringBlock
+{
+    enum UringBlockState state;
+    int64_t offset; // file offset the buffer holds, or is being read for
+    int length;     // bytes read so far
+    int error;      // AVERROR, once FAILED
+    bool resumed;   // a short read was continued from offset + length
+    bool at_end;    // a read came back short and will not be continued
+};
+
+// An AVIOContext over a local file read through io_uring, without a thread of
+// its own: every call from the demuxer tops up the reads ahead of it and only
+// waits when the block it needs has not arrived yet. The block for an offset
+// always goes to buffer (offset / URING_IO_BLOCK_BYTES) % URING_IO_BLOCKS, so
+// a seek needs no bookkeeping; blocks still buffered are simply found there.
+// Talks to the kernel directly rather than through liburing.
+struct UringIO
+{
+    AVIOContext *avio;
+    int fd;
+    bool direct; // opened with O_DIRECT
+    int64_t size;
+    int64_t pos;
+
+    int ring_fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring; // same mapping as sq_ring when the kernel allows it
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned sq_pending; // queued in the ring but not yet submitted
+    int in_flight;
+
+    uint8_t *buffers; // URING_IO_BLOCKS blocks, one allocation
+    bool registered;  // buffers pinned with the kernel, read with READ_FIXED
+    struct UringBlock blocks[URING_IO_BLOCKS];
+};
+
+typedef struct UringIO UringIO;
+
+int uring_io_open(UringIO *io, const char *filename);
+void uring_io_close(UringIO *io);
+
+#endif // URING_IO_H
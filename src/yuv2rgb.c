@@ -0,0 +1,261 @@
+#include "yuv2rgb.h"
+
+#include <libavutil/error.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define YUV2RGB_X86 1
+#endif
+
+// Fixed point with 6 fractional bits, as in libyuv: luma is widened to Y * 257
+// and scaled with a 16-bit high multiply, chroma terms are plain 16-bit products.
+// Every intermediate fits in int16; overflow only happens past the 0..255 clamp
+// and saturating adds keep it there.
+typedef struct
+{
+    uint16_t yg; // luma gain * 64 * 65536 / 257
+    int16_t yb;  // luma offset * gain * 64, plus rounding
+    int16_t vr;
+    int16_t ug;
+    int16_t vg;
+    int16_t ub;
+} YuvCoefficients;
+
+typedef void (*Yuv2RgbaRow)(const uint8_t *y, const uint8_t *u, const uint8_t *v, bool interleaved,
+                            uint8_t *dst, int width, const YuvCoefficients *c);
+
+static void yuv_coefficients(const AVFrame *frame, YuvCoefficients *c)
+{
+    double kr = 0.299, kb = 0.114;
+    if (frame->colorspace == AVCOL_SPC_BT709 ||
+        (frame->colorspace == AVCOL_SPC_UNSPECIFIED && frame->height >= 720))
+    {
+        kr = 0.2126;
+        kb = 0.0722;
+    }
+    double kg = 1.0 - kr - kb;
+    bool full = frame->color_range == AVCOL_RANGE_JPEG || frame->format == AV_PIX_FMT_YUVJ420P;
+    double y_gain = full ? 1.0 : 255.0 / 219.0;
+    double c_gain = full ? 1.0 : 255.0 / 224.0;
+    double y_offset = full ? 0.0 : 16.0;
+
+    c->yg = (uint16_t)(y_gain * 64.0 * 65536.0 / 257.0 + 0.5);
+    c->yb = (int16_t)(-y_offset * y_gain * 64.0 + 32.0);
+    c->vr = (int16_t)(2.0 * (1.0 - kr) * c_gain * 64.0 + 0.5);
+    c->ug = (int16_t)(2.0 * kb * (1.0 - kb) / kg * c_gain * 64.0 + 0.5);
+    c->vg = (int16_t)(2.0 * kr * (1.0 - kr) / kg * c_gain * 64.0 + 0.5);
+    c->ub = (int16_t)(2.0 * (1.0 - kb) * c_gain * 64.0 + 0.5);
+}
+
+static inline int16_t sat16(int v)
+{
+    return v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+}
+
+static inline uint8_t clamp255(int v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+// Bit-exact with the SIMD kernels; also finishes their rows.
+static void row_scalar(const uint8_t *y, const uint8_t *u, const uint8_t *v, bool interleaved,
+                       uint8_t *dst, int width, const YuvCoefficients *c)
+{
+    int step = interleaved ? 2 : 1;
+    for (int x = 0; x < width; x++)
+    {
+        int yy = sat16(((y[x] * 257 * c->yg) >> 16) + c->yb);
+        int cu = u[(x >> 1) * step] - 128;
+        int cv = v[(x >> 1) * step] - 128;
+        dst[4 * x + 0] = clamp255(sat16(yy + cv * c->vr) >> 6);
+        dst[4 * x + 1] = clamp255(sat16(yy - sat16(cu * c->ug + cv * c->vg)) >> 6);
+        dst[4 * x + 2] = clamp255(sat16(yy + cu * c->ub) >> 6);
+        dst[4 * x + 3] = 255;
+    }
+}
+
+#ifdef YUV2RGB_X86
+
+// 8 pixels: y and the already duplicated u, v are 16-bit lanes.
+__attribute__((target("sse4.1"))) static inline void rgba8_sse41(__m128i y, __m128i u, __m128i v, uint8_t *dst,
+                                                                 const YuvCoefficients *c)
+{
+    const __m128i bias = _mm_set1_epi16(128);
+    u = _mm_sub_epi16(u, bias);
+    v = _mm_sub_epi16(v, bias);
+    y = _mm_mulhi_epu16(_mm_or_si128(y, _mm_slli_epi16(y, 8)), _mm_set1_epi16((short)c->yg));
+    y = _mm_adds_epi16(y, _mm_set1_epi16(c->yb));
+
+    __m128i r = _mm_adds_epi16(y, _mm_mullo_epi16(v, _mm_set1_epi16(c->vr)));
+    __m128i g = _mm_subs_epi16(y, _mm_adds_epi16(_mm_mullo_epi16(u, _mm_set1_epi16(c->ug)),
+                                                 _mm_mullo_epi16(v, _mm_set1_epi16(c->vg))));
+    __m128i b = _mm_adds_epi16(y, _mm_mullo_epi16(u, _mm_set1_epi16(c->ub)));
+
+    const __m128i zero = _mm_setzero_si128(), max = _mm_set1_epi16(255);
+    r = _mm_min_epi16(_mm_max_epi16(_mm_srai_epi16(r, 6), zero), max);
+    g = _mm_min_epi16(_mm_max_epi16(_mm_srai_epi16(g, 6), zero), max);
+    b = _mm_min_epi16(_mm_max_epi16(_mm_srai_epi16(b, 6), zero), max);
+
+    __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+    __m128i ba = _mm_or_si128(b, _mm_set1_epi16((short)0xFF00));
+    _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(rg, ba));
+}
+
+// Loads 8 chroma samples of each plane as 16 duplicated bytes.
+__attribute__((target("sse4.1"))) static inline void load_chroma_sse41(const uint8_t *u, const uint8_t *v, bool interleaved,
+                                                                       __m128i *uu, __m128i *vv)
+{
+    __m128i cu, cv;
+    if (interleaved)
+    {
+        __m128i uv = _mm_loadu_si128((const __m128i *)u);
+        uv = _mm_shuffle_epi8(uv, _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15));
+        cu = uv;
+        cv = _mm_srli_si128(uv, 8);
+    }
+    else
+    {
+        cu = _mm_loadl_epi64((const __m128i *)u);
+        cv = _mm_loadl_epi64((const __m128i *)v);
+    }
+    *uu = _mm_unpacklo_epi8(cu, cu);
+    *vv = _mm_unpacklo_epi8(cv, cv);
+}
+
+__attribute__((target("sse4.1"))) static void row_sse41(const uint8_t *y, const uint8_t *u, const uint8_t *v, bool interleaved,
+                                                        uint8_t *dst, int width, const YuvCoefficients *c)
+{
+    int step = interleaved ? 2 : 1;
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i yy = _mm_loadu_si128((const __m128i *)(y + x));
+        __m128i uu, vv;
+        load_chroma_sse41(u + (x >> 1) * step, v + (x >> 1) * step, interleaved, &uu, &vv);
+        rgba8_sse41(_mm_cvtepu8_epi16(yy), _mm_cvtepu8_epi16(uu), _mm_cvtepu8_epi16(vv), dst + 4 * x, c);
+        rgba8_sse41(_mm_cvtepu8_epi16(_mm_srli_si128(yy, 8)), _mm_cvtepu8_epi16(_mm_srli_si128(uu, 8)),
+                    _mm_cvtepu8_epi16(_mm_srli_si128(vv, 8)), dst + 4 * x + 32, c);
+    }
+    // x is even, so the tail starts on a chroma sample boundary.
+    row_scalar(y + x, u + (x >> 1) * step, v + (x >> 1) * step, interleaved, dst + 4 * x, width - x, c);
+}
+
+// 16 pixels per call; see rgba8_sse41.
+__attribute__((target("avx2"))) static inline void rgba16_avx2(__m256i y, __m256i u, __m256i v, uint8_t *dst,
+                                                               const YuvCoefficients *c)
+{
+    const __m256i bias = _mm256_set1_epi16(128);
+    u = _mm256_sub_epi16(u, bias);
+    v = _mm256_sub_epi16(v, bias);
+    y = _mm256_mulhi_epu16(_mm256_or_si256(y, _mm256_slli_epi16(y, 8)), _mm256_set1_epi16((short)c->yg));
+    y = _mm256_adds_epi16(y, _mm256_set1_epi16(c->yb));
+
+    __m256i r = _mm256_adds_epi16(y, _mm256_mullo_epi16(v, _mm256_set1_epi16(c->vr)));
+    __m256i g = _mm256_subs_epi16(y, _mm256_adds_epi16(_mm256_mullo_epi16(u, _mm256_set1_epi16(c->ug)),
+                                                       _mm256_mullo_epi16(v, _mm256_set1_epi16(c->vg))));
+    __m256i b = _mm256_adds_epi16(y, _mm256_mullo_epi16(u, _mm256_set1_epi16(c->ub)));
+
+    const __m256i zero = _mm256_setzero_si256(), max = _mm256_set1_epi16(255);
+    r = _mm256_min_epi16(_mm256_max_epi16(_mm256_srai_epi16(r, 6), zero), max);
+    g = _mm256_min_epi16(_mm256_max_epi16(_mm256_srai_epi16(g, 6), zero), max);
+    b = _mm256_min_epi16(_mm256_max_epi16(_mm256_srai_epi16(b, 6), zero), max);
+
+    __m256i rg = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+    __m256i ba = _mm256_or_si256(b, _mm256_set1_epi16((short)0xFF00));
+    // Unpacks work within 128-bit lanes: lo holds pixels 0-3 and 8-11, hi 4-7 and 12-15.
+    __m256i lo = _mm256_unpacklo_epi16(rg, ba);
+    __m256i hi = _mm256_unpackhi_epi16(rg, ba);
+    _mm256_storeu_si256((__m256i *)dst, _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i *)(dst + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+__attribute__((target("avx2"))) static void row_avx2(const uint8_t *y, const uint8_t *u, const uint8_t *v, bool interleaved,
+                                                     uint8_t *dst, int width, const YuvCoefficients *c)
+{
+    const __m128i deinterleave = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+    int step = interleaved ? 2 : 1;
+    int x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        const uint8_t *cu = u + (x >> 1) * step;
+        const uint8_t *cv = v + (x >> 1) * step;
+        __m128i u16, v16;
+        if (interleaved)
+        {
+            __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)cu), deinterleave);
+            __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(cu + 16)), deinterleave);
+            u16 = _mm_unpacklo_epi64(a, b);
+            v16 = _mm_unpackhi_epi64(a, b);
+        }
+        else
+        {
+            u16 = _mm_loadu_si128((const __m128i *)cu);
+            v16 = _mm_loadu_si128((const __m128i *)cv);
+        }
+        __m128i y0 = _mm_loadu_si128((const __m128i *)(y + x));
+        __m128i y1 = _mm_loadu_si128((const __m128i *)(y + x + 16));
+        rgba16_avx2(_mm256_cvtepu8_epi16(y0), _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(u16, u16)),
+                    _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(v16, v16)), dst + 4 * x, c);
+        rgba16_avx2(_mm256_cvtepu8_epi16(y1), _mm256_cvtepu8_epi16(_mm_unpackhi_epi8(u16, u16)),
+                    _mm256_cvtepu8_epi16(_mm_unpackhi_epi8(v16, v16)), dst + 4 * x + 64, c);
+    }
+    row_sse41(y + x, u + (x >> 1) * step, v + (x >> 1) * step, interleaved, dst + 4 * x, width - x, c);
+}
+
+#endif // YUV2RGB_X86
+
+static Yuv2RgbaRow row_kernel;
+static const char *row_kernel_name;
+
+static void select_kernel(void)
+{
+    if (row_kernel_name)
+        return;
+    row_kernel = NULL;
+    row_kernel_name = "sws_scale";
+#ifdef YUV2RGB_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        row_kernel = row_avx2;
+        row_kernel_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse4.1"))
+    {
+        row_kernel = row_sse41;
+        row_kernel_name = "sse4.1";
+    }
+#endif
+}
+
+bool yuv2rgba_supported(enum AVPixelFormat format)
+{
+    select_kernel();
+    if (!row_kernel)
+        return false;
+    return format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_YUVJ420P || format == AV_PIX_FMT_NV12;
+}
+
+const char *yuv2rgba_kernel_name(void)
+{
+    select_kernel();
+    return row_kernel_name;
+}
+
+int yuv2rgba(const AVFrame *src, uint8_t *dst, int dst_linesize)
+{
+    if (!yuv2rgba_supported(src->format))
+        return AVERROR(ENOSYS);
+
+    YuvCoefficients c;
+    yuv_coefficients(src, &c);
+    bool interleaved = src->format == AV_PIX_FMT_NV12;
+    for (int row = 0; row < src->height; row++)
+    {
+        const uint8_t *u = src->data[1] + (row >> 1) * src->linesize[1];
+        const uint8_t *v = interleaved ? u + 1 : src->data[2] + (row >> 1) * src->linesize[2];
+        row_kernel(src->data[0] + row * src->linesize[0], u, v, interleaved, dst + row * dst_linesize, src->width, &c);
+    }
+    return 0;
+}
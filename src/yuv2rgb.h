@@ -0,0 +1,17 @@
+#ifndef YUV2RGB_H
+#define YUV2RGB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+
+// Same-size yuv420p / yuvj420p / nv12 to RGBA conversion with hand-written
+// SSE4.1 and AVX2 kernels, picked from CPUID on first use. Callers fall back
+// to sws_scale() whenever yuv2rgba() returns an error.
+
+bool yuv2rgba_supported(enum AVPixelFormat format);
+int yuv2rgba(const AVFrame *src, uint8_t *dst, int dst_linesize);
+const char *yuv2rgba_kernel_name(void);
+
+#endif // YUV2RGB_H